@@ -0,0 +1,151 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+
+#include <sys/stat.h>	/* statx(2), */
+#include <limits.h>	/* PATH_MAX, */
+#include <fcntl.h>	/* AT_*, */
+#include <errno.h>	/* E*, errno(3), */
+#include <assert.h>	/* assert(3), */
+#include <stdbool.h>	/* bool, */
+#include <talloc.h>
+#include "vfs/attributes.h"
+#include "vfs/node.h"
+#include "vfs/path.h"
+#include "vfs/tree.h"
+#include "vfs/memory.h"
+#include "vfs/descriptor.h"
+
+/**
+ * Get in @buffer the attributes in @mask of @node's actual file.  They
+ * are requested only if they were not already: then the file is
+ * stat'ed without holding the tree lock, unless it is done relatively
+ * to the descriptor of its parent, and they are cached until the
+ * actual path of @node is flushed, see flush_path().  As children
+ * lists, these attributes are not updated if the actual file changes.
+ * This function returns -errno if an error occurred, otherwise 0.
+ */
+int get_attributes(Node *node, unsigned int mask, struct statx *buffer)
+{
+	Tree *tree = node->tree;
+	char path[PATH_MAX];
+	size_t generation;
+	bool is_read = false;
+	ssize_t size = 0;
+	int status = 0;
+
+	read_lock_tree(tree);
+
+	generation = get_generation(tree);
+
+	if (node->negative)
+		status = -ENOENT;
+	else if (node->attributes_ != NULL && (node->attributes_->mask & mask) == mask) {
+		*buffer = node->attributes_->statx;
+		read_unlock_tree(tree);
+		return 0;
+	}
+	else {
+		/* The new attributes replace the previous ones.  */
+		if (node->attributes_ != NULL)
+			mask |= node->attributes_->mask;
+
+		if (uses_descriptors(tree) && !node->special && node->parent != node) {
+			is_read = true;
+			status = stat_child(node->parent, node->name, mask, buffer);
+		}
+		else
+			size = render_path(node, ACTUAL_PATH, path, sizeof(path));
+	}
+
+	read_unlock_tree(tree);
+
+	if (status < 0)
+		return status;
+
+	if (!is_read) {
+		if (size < 0)
+			return -ENAMETOOLONG;
+
+		status = statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, mask, buffer);
+		if (status < 0)
+			return -errno;
+	}
+
+	/* @node might have been freed if the generation has
+	 * changed.  */
+	write_lock_tree(tree);
+	if (get_generation(tree) == generation)
+		set_attributes(node, mask, buffer);
+	write_unlock_tree(tree);
+
+	return 0;
+}
+
+/**
+ * Cache @buffer as the attributes in @mask of @node's actual file.
+ * The tree has to be write-locked.
+ */
+void set_attributes(Node *node, unsigned int mask, const struct statx *buffer)
+{
+	assert(is_write_locked(node->tree));
+
+	if (node->attributes_ == NULL) {
+		node->attributes_ = talloc(node, Attributes);
+		if (node->attributes_ == NULL)
+			return;
+
+		talloc_set_name_const(node->attributes_, "$attributes");
+		account_memory(node->tree, TALLOC_CHUNK_SIZE(sizeof(Attributes)));
+	}
+
+	node->attributes_->mask  = mask;
+	node->attributes_->statx = *buffer;
+}
+
+/**
+ * Delete the attributes cached for @node, if any.  The tree has to be
+ * write-locked.
+ */
+void flush_attributes(Node *node)
+{
+	assert(is_write_locked(node->tree));
+
+	if (node->attributes_ == NULL)
+		return;
+
+	account_memory(node->tree, -(ssize_t) TALLOC_CHUNK_SIZE(sizeof(Attributes)));
+	TALLOC_FREE(node->attributes_);
+}
+
+/**
+ * Fetch the attributes in @mask for all the children of a directory
+ * of @node's tree as soon as it is filled from the actual
+ * file-system, so as the whole directory is stat'ed in one batch,
+ * without holding the tree lock.  0 disables this mode.
+ */
+void set_batch_attributes(Node *node, unsigned int mask)
+{
+	write_lock_tree(node->tree);
+	__atomic_store_n(&node->tree->batch_attributes, mask, __ATOMIC_RELAXED);
+	write_unlock_tree(node->tree);
+}
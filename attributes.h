@@ -0,0 +1,54 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_ATTRIBUTES
+#define PROOT_VFS_ATTRIBUTES
+
+#include <sys/stat.h>	/* struct statx, */
+#include "vfs/node.h"
+#include "vfs/tree.h"
+
+/* Attributes of the actual file of a node, see get_attributes().  */
+typedef struct attributes
+{
+	/* Attributes requested so far, some of them might not be
+	 * supported by the file-system, see statx(2).  */
+	unsigned int mask;
+
+	struct statx statx;
+} Attributes;
+
+extern int get_attributes(Node *node, unsigned int mask, struct statx *buffer);
+extern void set_attributes(Node *node, unsigned int mask, const struct statx *buffer);
+extern void flush_attributes(Node *node);
+extern void set_batch_attributes(Node *node, unsigned int mask);
+
+/**
+ * Get the attributes fetched for all the children of a directory of
+ * @tree as soon as it is filled, see set_batch_attributes().
+ */
+static inline unsigned int get_batch_attributes(const Tree *tree)
+{
+	return __atomic_load_n(&tree->batch_attributes, __ATOMIC_RELAXED);
+}
+
+#endif /* PROOT_VFS_ATTRIBUTES */
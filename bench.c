@@ -0,0 +1,1573 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+/* Benchmarks of the main operations on a tree, either a synthetic one
+ * generated in a temporary directory, or an existing directory.  Each
+ * result is printed on one line made of the name of the benchmark
+ * followed by "key=value" pairs, so as results can be compared with
+ * usual text tools.  */
+
+#include <sys/stat.h>	/* mkdir(2), */
+#include <sys/param.h>	/* MIN, MAX, */
+#include <sys/syscall.h>	/* SYS_getdents64, */
+#include <stdio.h>	/* *printf(3), remove(3), */
+#include <stdlib.h>	/* exit(3), strtoul(3), mkdtemp(3), */
+#include <string.h>	/* str*(3), */
+#include <unistd.h>	/* getopt(3), sysconf(3), symlink(2), */
+#include <errno.h>	/* ENOMEM, */
+#include <dirent.h>	/* DT_*, */
+#include <fcntl.h>	/* open(2), O_*, */
+#include <ftw.h>	/* nftw(3), */
+#include <limits.h>	/* PATH_MAX, */
+#include <stdint.h>	/* SIZE_MAX, */
+#include <inttypes.h>	/* PRIu64, */
+#include <pthread.h>	/* pthread_*, */
+#include <time.h>	/* clock_gettime(3), */
+#include <talloc.h>
+#include <uthash.h>
+#include "vfs/node.h"
+#include "vfs/path.h"
+#include "vfs/find.h"
+#include "vfs/children.h"
+#include "vfs/symlink.h"
+#include "vfs/tree.h"
+#include "vfs/memory.h"
+#include "vfs/snapshot.h"
+#include "vfs/prefetch.h"
+#include "vfs/descriptor.h"
+#include "vfs/component.h"
+#include "vfs/clone.h"
+#include "vfs/evaluator.h"
+#include "vfs/stats.h"
+#include "vfs/binding.h"
+#include "vfs/listing.h"
+
+/* Directory entry as indexed by uthash, see bench_index().  */
+typedef struct
+{
+	UT_hash_handle hh;
+	char name[];
+} Entry;
+
+/* Shape of the synthetic tree, see generate_tree().  */
+static size_t fanout = 16;
+static size_t depth = 3;
+static size_t symlink_density = 10;
+static size_t name_length = 8;
+
+static const char *directory;
+
+/* Virtual paths of all the nodes of the tree, looked up by each
+ * thread, and the same paths with a suffix so as they don't exist.  */
+static const char **paths;
+static const char **missing_paths;
+static size_t nb_paths;
+static size_t max_paths = 100000;
+
+static Node *root;
+static size_t nb_lookups = 200000;
+static pthread_barrier_t barrier;
+
+typedef enum {
+	LOOKUP_COLD,
+	LOOKUP_HIT,
+	LOOKUP_MISS,
+} LookupMode;
+
+static const char *lookup_mode_names[] = { "cold", "hit", "miss" };
+
+/* Views diverging concurrently, see bench_clone().  */
+static Node **views;
+static size_t nb_views;
+static size_t nb_view_threads;
+
+#define VIEW_LOOKUPS 100
+
+static double now(void)
+{
+	struct timespec timespec;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &timespec);
+	return timespec.tv_sec * 1e9 + timespec.tv_nsec;
+}
+
+/**
+ * Write in @name the name of the @index-th entry of a directory, made
+ * of @kind then @index padded to name_length characters.
+ */
+static void make_name(char *name, size_t size, char kind, size_t index)
+{
+	int width = name_length > 1 ? name_length - 1 : 1;
+
+	(void) snprintf(name, size, "%c%0*zu", kind, width, index);
+}
+
+/**
+ * Populate @path with fanout entries, recursively up to @level ==
+ * depth.  Entries are either directories (only above the last level),
+ * regular files, or -- with a probability of symlink_density percent
+ * -- symbolic links to the first entry of the same directory.  This
+ * function returns -errno if an error occurred, otherwise 0.
+ */
+static int generate_tree(const char *path, size_t level, unsigned int *seed)
+{
+	char child[PATH_MAX];
+	char first[NAME_MAX + 1];
+	size_t i;
+	int status;
+
+	for (i = 0; i < fanout; i++) {
+		char name[NAME_MAX + 1];
+		char kind;
+		int fd;
+
+		if (i > 0 && (size_t) (rand_r(seed) % 100) < symlink_density)
+			kind = 'l';
+		else if (level < depth && i % 2 == 0)
+			kind = 'd';
+		else
+			kind = 'f';
+
+		make_name(name, sizeof(name), kind, i);
+		if (i == 0)
+			strcpy(first, name);
+
+		if (snprintf(child, sizeof(child), "%s/%s", path, name) >= (int) sizeof(child))
+			return -ENAMETOOLONG;
+
+		switch (kind) {
+		case 'd':
+			status = mkdir(child, 0700);
+			if (status < 0)
+				return -errno;
+
+			status = generate_tree(child, level + 1, seed);
+			if (status < 0)
+				return status;
+			break;
+
+		case 'l':
+			status = symlink(first, child);
+			if (status < 0)
+				return -errno;
+			break;
+
+		default:
+			fd = open(child, O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+			if (fd < 0)
+				return -errno;
+			(void) close(fd);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *statl, int flag, struct FTW *ftw)
+{
+	(void) statl;
+	(void) flag;
+	(void) ftw;
+
+	return remove(path);
+}
+
+/**
+ * Fill recursively @node, then return the number of its descendants.
+ * If @record is true, the virtual paths of these latter are recorded
+ * in @paths too.
+ */
+static size_t fill_all(Node *node, bool record)
+{
+	size_t nb_nodes = 0;
+	Node *child;
+
+	if (record && nb_paths < max_paths) {
+		const char *path = get_path(node, VIRTUAL_PATH);
+
+		paths[nb_paths] = talloc_strdup(paths, path);
+		missing_paths[nb_paths] = talloc_asprintf(missing_paths, "%s%s", path,
+							strcmp(path, "/") == 0 ? "missing" : "-missing");
+		if (paths[nb_paths] == NULL || missing_paths[nb_paths] == NULL)
+			exit(EXIT_FAILURE);
+		nb_paths++;
+	}
+
+	if (node->type != DT_DIR)
+		return 0;
+
+	if (!node->children_filled && fill_children(node) < 0)
+		return 0;
+
+	FOR_EACH_CHILD(child, node)
+		nb_nodes += 1 + fill_all(child, record);
+
+	return nb_nodes;
+}
+
+/**
+ * Create a new tree for the benchmarked directory.
+ */
+static Node *new_tree(void)
+{
+	Node *node;
+
+	node = new_node(NULL, "/", -1, DT_DIR);
+	if (node == NULL || set_actual_path(node, directory) < 0)
+		exit(EXIT_FAILURE);
+
+	return node;
+}
+
+static void *lookup_thread(void *data)
+{
+	size_t index = (size_t) data & 0xFFFF;
+	LookupMode mode = (size_t) data >> 16;
+	const char **list = (mode == LOOKUP_MISS ? missing_paths : paths);
+	size_t i;
+	int error;
+
+	pthread_barrier_wait(&barrier);
+
+	/* Each thread starts somewhere else in @list.  */
+	for (i = 0; i < nb_lookups; i++) {
+		const char *path = list[(index * 7919 + i) % nb_paths];
+		(void) find_node(root, root, path, 0, &error);
+	}
+
+	return NULL;
+}
+
+/**
+ * Run nb_lookups lookups in each of @nb_threads threads; the tree is
+ * flushed first if @mode is LOOKUP_COLD.  This function prints one
+ * line of results.
+ */
+static void bench_lookups(size_t nb_threads, LookupMode mode)
+{
+	pthread_t *threads;
+	double start;
+	double duration;
+	size_t i;
+
+	if (mode == LOOKUP_COLD)
+		(void) flush_children(root, false);
+
+	threads = talloc_array(NULL, pthread_t, nb_threads);
+	if (threads == NULL)
+		exit(EXIT_FAILURE);
+
+	pthread_barrier_init(&barrier, NULL, nb_threads + 1);
+
+	for (i = 0; i < nb_threads; i++)
+		pthread_create(&threads[i], NULL, lookup_thread, (void *) (i | mode << 16));
+
+	pthread_barrier_wait(&barrier);
+	start = now();
+
+	for (i = 0; i < nb_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	duration = now() - start;
+	pthread_barrier_destroy(&barrier);
+	talloc_free(threads);
+
+	printf("find_node mode=%s threads=%zu ops=%zu ns_per_op=%.1f mops_per_s=%.3f\n",
+		lookup_mode_names[mode], nb_threads, nb_threads * nb_lookups,
+		duration / nb_lookups,
+		nb_threads * nb_lookups / duration * 1e3);
+}
+
+/**
+ * List recursively @node with read_children() through a buffer of
+ * @size bytes, then return the number of entries listed.
+ */
+static size_t list_all(Node *node, size_t size)
+{
+	size_t nb_entries = 0;
+	uint64_t offset = 0;
+	char *buffer;
+	ssize_t used;
+
+	/* Subdirectories are listed before the end of this one.  */
+	buffer = malloc(size);
+	if (buffer == NULL)
+		exit(EXIT_FAILURE);
+
+	while ((used = read_children(node, &offset, buffer, size)) > 0) {
+		struct linux_dirent64 *entry;
+		ssize_t position;
+
+		for (position = 0; position < used; position += entry->d_reclen) {
+			Node *child;
+
+			entry = (struct linux_dirent64 *) (buffer + position);
+			nb_entries++;
+
+			if (entry->d_type != DT_DIR || entry->d_off <= 2)
+				continue;
+
+			child = find_in_index(node, entry->d_name, -1);
+			if (child != NULL)
+				nb_entries += list_all(child, size);
+		}
+	}
+
+	free(buffer);
+
+	return nb_entries;
+}
+
+/**
+ * Read with getdents64(2) each actual directory of @node recursively
+ * through @buffer, of @size bytes, as done without read_children(),
+ * then return the number of entries read.
+ */
+static size_t list_all_actual(Node *node, char *buffer, size_t size)
+{
+	size_t nb_entries = 0;
+	Node *child;
+	long used;
+	int fd;
+
+	fd = open(get_path(node, ACTUAL_PATH), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	while ((used = syscall(SYS_getdents64, fd, buffer, size)) > 0) {
+		struct linux_dirent64 *entry;
+		long position;
+
+		for (position = 0; position < used; position += entry->d_reclen) {
+			entry = (struct linux_dirent64 *) (buffer + position);
+			nb_entries++;
+		}
+	}
+
+	(void) close(fd);
+
+	FOR_EACH_CHILD(child, node) {
+		if (child->type == DT_DIR)
+			nb_entries += list_all_actual(child, buffer, size);
+	}
+
+	return nb_entries;
+}
+
+/**
+ * Compare listing recursively an entirely filled tree with
+ * read_children() -- as "ls -R" in a warm tree -- to reading its
+ * actual directories, with a buffer of @size bytes.  This function
+ * prints one line of results.
+ */
+static void bench_listing(size_t size)
+{
+	size_t nb_actual_entries;
+	size_t nb_entries;
+	double listed;
+	double actual;
+	double start;
+	char *buffer;
+	Node *tree;
+
+	buffer = malloc(size);
+	if (buffer == NULL)
+		exit(EXIT_FAILURE);
+
+	tree = new_tree();
+	(void) fill_all(tree, false);
+
+	start = now();
+	nb_entries = list_all(tree, size);
+	listed = now() - start;
+
+	start = now();
+	nb_actual_entries = list_all_actual(tree, buffer, size);
+	actual = now() - start;
+
+	printf("read_children buffer=%zu entries=%zu ns_per_entry=%.1f "
+		"actual_entries=%zu actual_ns_per_entry=%.1f\n",
+		size, nb_entries, nb_entries > 0 ? listed / nb_entries : 0,
+		nb_actual_entries, nb_actual_entries > 0 ? actual / nb_actual_entries : 0);
+
+	(void) delete_tree(tree);
+	free(buffer);
+}
+
+/**
+ * Translate the actual @path back as the string prefix matching
+ * done outside the VFS would do: the @nb_bindings actual paths in
+ * @actual_paths are all compared, the longest prefix wins, and its
+ * virtual path is in @virtual_paths.
+ */
+static ssize_t detranslate_linear(const char **actual_paths, const char **virtual_paths,
+				size_t nb_bindings, const char *path, char *buffer, size_t size)
+{
+	size_t best_length = 0;
+	size_t best = SIZE_MAX;
+	size_t i;
+
+	for (i = 0; i < nb_bindings; i++) {
+		size_t length = strlen(actual_paths[i]);
+
+		if (length < best_length || strncmp(actual_paths[i], path, length) != 0
+		    || (path[length] != '/' && path[length] != '\0'))
+			continue;
+
+		best_length = length;
+		best = i;
+	}
+
+	if (best == SIZE_MAX)
+		return -ENOENT;
+
+	return snprintf(buffer, size, "%s%s", virtual_paths[best], path + best_length);
+}
+
+/**
+ * Compare detranslate_path() with detranslate_linear() on the actual
+ * paths of all the recorded paths, once @nb_bindings directories --
+ * plus the root -- are bound to their own actual path.  This
+ * function prints one line of results.
+ */
+static void bench_detranslate(size_t nb_bindings)
+{
+	const char **virtual_paths;
+	const char **actual_paths;
+	const char **bindings;
+	const char **expected;
+	char buffer[PATH_MAX];
+	size_t nb_mismatches = 0;
+	size_t nb_targets = 0;
+	size_t nb_bound = 0;
+	double indexed;
+	double linear;
+	double start;
+	Node *tree;
+	size_t i;
+	int error;
+
+	tree = new_tree();
+	(void) fill_all(tree, false);
+
+	actual_paths  = talloc_array(tree, const char *, nb_paths);
+	expected      = talloc_array(tree, const char *, nb_paths);
+	bindings      = talloc_array(tree, const char *, nb_bindings + 1);
+	virtual_paths = talloc_array(tree, const char *, nb_bindings + 1);
+	if (actual_paths == NULL || expected == NULL || bindings == NULL || virtual_paths == NULL)
+		exit(EXIT_FAILURE);
+
+	/* The root is bound too, its virtual path is "" so as the
+	 * suffix provides the separator.  */
+	bindings[nb_bound] = talloc_strdup(tree, get_path(tree, ACTUAL_PATH));
+	virtual_paths[nb_bound] = "";
+	nb_bound++;
+
+	for (i = 0; i < nb_paths; i++) {
+		const char *actual_path;
+		Node *node;
+
+		node = find_node(tree, tree, paths[i], O_NOFOLLOW, &error);
+		if (node == NULL || node == tree)
+			continue;
+
+		actual_path = talloc_strdup(tree, get_path(node, ACTUAL_PATH));
+		if (actual_path == NULL)
+			exit(EXIT_FAILURE);
+
+		actual_paths[nb_targets] = actual_path;
+		expected[nb_targets] = paths[i];
+		nb_targets++;
+
+		if (node->type != DT_DIR || nb_bound > nb_bindings)
+			continue;
+
+		bindings[nb_bound] = actual_path;
+		virtual_paths[nb_bound] = paths[i];
+		if (set_actual_path(node, actual_path) < 0)
+			exit(EXIT_FAILURE);
+		nb_bound++;
+	}
+
+	if (nb_targets == 0) {
+		(void) delete_tree(tree);
+		return;
+	}
+
+	start = now();
+	for (i = 0; i < nb_lookups; i++) {
+		if (detranslate_path(tree, actual_paths[i % nb_targets], buffer, sizeof(buffer)) < 0
+		    || strcmp(buffer, expected[i % nb_targets]) != 0)
+			nb_mismatches++;
+	}
+	indexed = now() - start;
+
+	start = now();
+	for (i = 0; i < nb_lookups; i++)
+		(void) detranslate_linear(bindings, virtual_paths, nb_bound,
+					actual_paths[i % nb_targets], buffer, sizeof(buffer));
+	linear = now() - start;
+
+	printf("detranslate bindings=%zu ops=%zu ns_per_op=%.1f linear_ns_per_op=%.1f mismatches=%zu\n",
+		nb_bound - 1, nb_lookups, indexed / nb_lookups, linear / nb_lookups, nb_mismatches);
+
+	(void) delete_tree(tree);
+}
+
+/**
+ * Compare translate_path() with get_path(find_node()) on existing
+ * paths, then on missing paths with O_CREAT, where the memory usage
+ * of the tree is reported after these latter.  This function prints
+ * one line of results.
+ */
+static void bench_translate(void)
+{
+	char buffer[PATH_MAX];
+	double translated;
+	double found;
+	double start;
+	Node *tree;
+	Node *node;
+	size_t found_usage;
+	size_t translated_usage;
+	size_t i;
+	int error;
+
+	tree = new_tree();
+	(void) fill_all(tree, false);
+
+	start = now();
+	for (i = 0; i < nb_lookups; i++) {
+		node = find_node(tree, tree, paths[i % nb_paths], 0, &error);
+		if (node != NULL)
+			(void) get_path(node, ACTUAL_PATH);
+	}
+	found = now() - start;
+
+	for (i = 0; i < nb_paths; i++)
+		(void) find_node(tree, tree, missing_paths[i], O_CREAT, &error);
+	found_usage = get_memory_usage(tree);
+
+	(void) delete_tree(tree);
+
+	tree = new_tree();
+	(void) fill_all(tree, false);
+
+	start = now();
+	for (i = 0; i < nb_lookups; i++)
+		(void) translate_path(tree, tree, paths[i % nb_paths], 0, buffer, sizeof(buffer));
+	translated = now() - start;
+
+	for (i = 0; i < nb_paths; i++)
+		(void) translate_path(tree, tree, missing_paths[i], O_CREAT, buffer, sizeof(buffer));
+	translated_usage = get_memory_usage(tree);
+
+	(void) delete_tree(tree);
+
+	printf("translate_path ops=%zu ns_per_op=%.1f get_path_ns_per_op=%.1f "
+		"created=%zu usage=%zu get_path_usage=%zu\n",
+		nb_lookups, translated / nb_lookups, found / nb_lookups, nb_paths,
+		translated_usage, found_usage);
+}
+
+/**
+ * Compare the lookup of batches of @batch_size consecutive paths --
+ * that is, siblings or close relatives -- with find_nodes() and with
+ * one find_node() per path.  This function prints one line of
+ * results.
+ */
+static void bench_find_nodes(size_t batch_size, LookupMode mode)
+{
+	const char **list = (mode == LOOKUP_MISS ? missing_paths : paths);
+	double separate;
+	double batched;
+	double start;
+	size_t nb_batches;
+	Node **nodes;
+	int *errors;
+	size_t i;
+	size_t j;
+
+	if (batch_size > nb_paths)
+		batch_size = nb_paths;
+
+	nodes = talloc_array(NULL, Node *, batch_size);
+	errors = talloc_array(NULL, int, batch_size);
+	if (nodes == NULL || errors == NULL)
+		exit(EXIT_FAILURE);
+
+	nb_batches = nb_lookups / batch_size;
+
+	start = now();
+	for (i = 0; i < nb_batches; i++) {
+		const char **batch = &list[(i * batch_size) % (nb_paths - batch_size + 1)];
+
+		for (j = 0; j < batch_size; j++)
+			nodes[j] = find_node(root, root, batch[j], 0, &errors[j]);
+	}
+	separate = now() - start;
+
+	start = now();
+	for (i = 0; i < nb_batches; i++) {
+		const char **batch = &list[(i * batch_size) % (nb_paths - batch_size + 1)];
+
+		find_nodes(root, root, batch, batch_size, 0, nodes, errors);
+	}
+	batched = now() - start;
+
+	talloc_free(nodes);
+	talloc_free(errors);
+
+	printf("find_nodes mode=%s batch=%zu ops=%zu ns_per_path=%.1f find_node_ns_per_path=%.1f\n",
+		lookup_mode_names[mode], batch_size, nb_batches * batch_size,
+		batched / (nb_batches * batch_size),
+		separate / (nb_batches * batch_size));
+}
+
+/**
+ * Measure the cost of filling every directory of a new tree, where
+ * up to @max_descriptors directories are opened relatively to their
+ * parent, and the memory used per node once filled.
+ */
+static void bench_fill(size_t max_descriptors)
+{
+	size_t empty_size;
+	size_t nb_nodes;
+	double start;
+	double duration;
+	Node *tree;
+
+	tree = new_tree();
+	max_descriptors = set_directory_descriptors(tree, max_descriptors);
+	empty_size = talloc_total_size(tree);
+
+	start = now();
+	nb_nodes = fill_all(tree, false);
+	duration = now() - start;
+
+	printf("fill_children descriptors=%zu entries=%zu ns_per_entry=%.1f\n",
+		max_descriptors, nb_nodes, duration / nb_nodes);
+
+	printf("memory nodes=%zu bytes_per_node=%.1f estimated_bytes_per_node=%.1f\n",
+		nb_nodes, (double) (talloc_total_size(tree) - empty_size) / nb_nodes,
+		(double) get_memory_usage(tree) / nb_nodes);
+
+	(void) delete_tree(tree);
+}
+
+/**
+ * Add to @nodes the descendants of @node that are @level levels
+ * below, and return their number.
+ */
+static size_t collect_level(Node *node, size_t level, Node **nodes, size_t max_nodes)
+{
+	size_t nb_nodes = 0;
+	Node *child;
+
+	if (level == 0) {
+		nodes[0] = node;
+		return 1;
+	}
+
+	FOR_EACH_CHILD(child, node) {
+		if (nb_nodes == max_nodes)
+			break;
+		nb_nodes += collect_level(child, level - 1, nodes + nb_nodes, max_nodes - nb_nodes);
+	}
+
+	return nb_nodes;
+}
+
+/**
+ * Measure the cost of computing the virtual path of the nodes at each
+ * level of a new tree, without any path computed in the ancestors.
+ */
+static void bench_get_path(void)
+{
+	Node **nodes;
+	size_t level;
+	Node *tree;
+
+	tree = new_tree();
+	(void) fill_all(tree, false);
+
+	nodes = talloc_array(NULL, Node *, max_paths);
+	if (nodes == NULL)
+		exit(EXIT_FAILURE);
+
+	for (level = 1; ; level++) {
+		double start;
+		double duration;
+		size_t nb_nodes;
+		size_t i;
+
+		nb_nodes = collect_level(tree, level, nodes, max_paths);
+		if (nb_nodes == 0)
+			break;
+
+		flush_path(tree, VIRTUAL_PATH);
+
+		start = now();
+		for (i = 0; i < nb_nodes; i++)
+			(void) get_path(nodes[i], VIRTUAL_PATH);
+		duration = now() - start;
+
+		printf("get_path depth=%zu ops=%zu ns_per_op=%.1f\n",
+			level, nb_nodes, duration / nb_nodes);
+	}
+
+	talloc_free(nodes);
+	(void) delete_tree(tree);
+}
+
+/**
+ * Measure the cost of set_actual_path() on each top-level directory
+ * of a new tree, once this latter is entirely filled.
+ */
+static void bench_set_actual_path(void)
+{
+	double duration = 0;
+	size_t nb_nodes = 0;
+	size_t nb_ops = 0;
+	Node *child;
+	Node *tree;
+
+	tree = new_tree();
+	(void) fill_all(tree, false);
+
+	FOR_EACH_CHILD(child, tree) {
+		char path[PATH_MAX];
+		double start;
+
+		if (child->type != DT_DIR)
+			continue;
+
+		nb_nodes += fill_all(child, false);
+		strcpy(path, get_path(child, ACTUAL_PATH));
+
+		start = now();
+		(void) set_actual_path(child, path);
+		duration += now() - start;
+
+		nb_ops++;
+	}
+
+	if (nb_ops > 0)
+		printf("set_actual_path ops=%zu nodes_per_op=%.1f ns_per_op=%.1f ns_per_node=%.1f\n",
+			nb_ops, (double) nb_nodes / nb_ops, duration / nb_ops,
+			nb_nodes > 0 ? duration / nb_nodes : 0);
+
+	(void) delete_tree(tree);
+}
+
+/**
+ * Measure the cost of getting the actual path of the node for each
+ * of the recorded paths in @tree.
+ */
+static double get_all_paths(Node *tree)
+{
+	double start;
+	Node *node;
+	size_t i;
+	int error;
+
+	start = now();
+	for (i = 0; i < nb_paths; i++) {
+		node = find_node(tree, tree, paths[i], 0, &error);
+		if (node != NULL)
+			(void) get_path(node, ACTUAL_PATH);
+	}
+
+	return now() - start;
+}
+
+/**
+ * Measure the cost of binding the root of an entirely filled tree to
+ * the same directory again, then of walking all the recorded paths
+ * once nodes are revalidated, as opposed to once the tree is
+ * flushed.  Also measure how getting actual paths is slowed down
+ * once a single top-level directory is bound again.
+ */
+static void bench_rebind(void)
+{
+	char path[PATH_MAX];
+	double revalidated;
+	double flushed;
+	double unbound;
+	double bound;
+	double rebind;
+	double start;
+	size_t usage;
+	Node *child;
+	Node *tree;
+	size_t i;
+	int error;
+
+	tree = new_tree();
+	(void) fill_all(tree, false);
+
+	start = now();
+	(void) set_actual_path(tree, directory);
+	rebind = now() - start;
+
+	start = now();
+	for (i = 0; i < nb_paths; i++)
+		(void) find_node(tree, tree, paths[i], 0, &error);
+	revalidated = now() - start;
+	usage = get_memory_usage(tree);
+
+	(void) flush_children(tree, false);
+
+	start = now();
+	for (i = 0; i < nb_paths; i++)
+		(void) find_node(tree, tree, paths[i], 0, &error);
+	flushed = now() - start;
+
+	printf("rebind paths=%zu rebind_ns=%.1f revalidated_ns_per_path=%.1f "
+		"flushed_ns_per_path=%.1f bytes_kept=%zu\n",
+		nb_paths, rebind, revalidated / nb_paths, flushed / nb_paths, usage);
+
+	FOR_EACH_CHILD(child, tree) {
+		if (child->type != DT_DIR)
+			continue;
+
+		(void) get_all_paths(tree);
+		unbound = get_all_paths(tree);
+
+		strcpy(path, get_path(child, ACTUAL_PATH));
+		(void) set_actual_path(child, path);
+
+		bound = get_all_paths(tree);
+
+		printf("rebind_subtree paths=%zu before_ns_per_path=%.1f after_ns_per_path=%.1f\n",
+			nb_paths, unbound / nb_paths, bound / nb_paths);
+		break;
+	}
+
+	(void) delete_tree(tree);
+}
+
+/**
+ * Measure the cost of flushing then deleting an entirely filled
+ * tree.
+ */
+static void bench_flush_delete(void)
+{
+	size_t nb_nodes;
+	ssize_t status;
+	double start;
+	double duration;
+	Node *tree;
+
+	tree = new_tree();
+	(void) fill_all(tree, false);
+
+	start = now();
+	nb_nodes = flush_children(tree, false);
+	duration = now() - start;
+
+	printf("flush_children nodes=%zu ns_per_node=%.1f\n",
+		nb_nodes, nb_nodes > 0 ? duration / nb_nodes : 0);
+
+	(void) fill_all(tree, false);
+
+	start = now();
+	status = delete_tree(tree);
+	duration = now() - start;
+
+	if (status > 0)
+		printf("delete_tree nodes=%zd ns_per_node=%.1f\n", status, duration / status);
+}
+
+/**
+ * Fill recursively @node and read all the symlinks below it, as done
+ * to warm up a tree at startup.  This function returns the number of
+ * descendants of @node.
+ */
+static size_t warm_up(Node *node)
+{
+	size_t nb_nodes = 0;
+	Node *child;
+	int error;
+
+	if (node->type == DT_LNK)
+		(void) get_symlink(node, &error);
+
+	if (node->type != DT_DIR)
+		return 0;
+
+	if (!node->children_filled && fill_children(node) < 0)
+		return 0;
+
+	FOR_EACH_CHILD(child, node)
+		nb_nodes += 1 + warm_up(child);
+
+	return nb_nodes;
+}
+
+/**
+ * Measure the cost of warming up a new tree from the actual
+ * file-system, then from a snapshot of this latter.
+ */
+static void bench_snapshot(void)
+{
+	char path[] = "/tmp/vfs-bench-snapshot.XXXXXX";
+	double live_duration;
+	double save_duration;
+	double load_duration;
+	double duration;
+	size_t nb_nodes;
+	double start;
+	Node *tree;
+	int status;
+	int fd;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return;
+	(void) close(fd);
+
+	tree = new_tree();
+
+	start = now();
+	nb_nodes = warm_up(tree);
+	live_duration = now() - start;
+
+	start = now();
+	status = save_snapshot(tree, path);
+	save_duration = now() - start;
+
+	(void) delete_tree(tree);
+	if (status < 0 || nb_nodes == 0)
+		goto end;
+
+	tree = new_tree();
+
+	start = now();
+	status = load_snapshot(tree, path);
+	load_duration = now() - start;
+
+	start = now();
+	(void) warm_up(tree);
+	duration = now() - start;
+
+	(void) delete_tree(tree);
+	if (status < 0)
+		goto end;
+
+	printf("snapshot nodes=%zu save_ns=%.0f load_ns=%.0f "
+		"warm_up_ns_per_node=%.1f live_warm_up_ns_per_node=%.1f\n",
+		nb_nodes, save_duration, load_duration,
+		duration / nb_nodes, live_duration / nb_nodes);
+end:
+	(void) unlink(path);
+}
+
+/**
+ * Measure the cost of warming up a new tree with prefetch_tree(), in
+ * @nb_threads threads.
+ */
+static void bench_prefetch(size_t nb_threads)
+{
+	ssize_t nb_filled;
+	size_t nb_nodes;
+	double duration;
+	double start;
+	Node *tree;
+
+	tree = new_tree();
+
+	start = now();
+	nb_filled = prefetch_tree(tree, SIZE_MAX, NULL, NULL, nb_threads);
+	duration = now() - start;
+
+	/* This only counts nodes, everything is prefetched.  */
+	nb_nodes = warm_up(tree);
+
+	if (nb_filled >= 0 && nb_nodes > 0)
+		printf("prefetch_tree threads=%zu directories=%zd nodes=%zu ns_per_node=%.1f\n",
+			nb_threads, nb_filled, nb_nodes, duration / nb_nodes);
+
+	(void) delete_tree(tree);
+}
+
+/**
+ * Compare the child index of a directory of @nb_children children
+ * with the uthash table it replaces: latency of a successful and of
+ * an unsuccessful probe, and memory used per child on top of the
+ * node itself.
+ */
+static void bench_index(size_t nb_children)
+{
+	double index_hit, index_miss;
+	double hash_hit, hash_miss;
+	size_t index_size;
+	size_t hash_size;
+	size_t nb_probes;
+	char **names;
+	Entry *table = NULL;
+	Entry *entry;
+	Node *directory;
+	Node *child;
+	double start;
+	size_t i;
+
+	directory = new_node(NULL, "/", -1, DT_DIR);
+	names = talloc_array(directory, char *, nb_children);
+	if (directory == NULL || names == NULL)
+		exit(EXIT_FAILURE);
+
+	index_size = 0;
+	for (i = 0; i < nb_children; i++) {
+		char name[NAME_MAX];
+
+		make_name(name, sizeof(name), 'e', i);
+		names[i] = talloc_strdup(names, name);
+
+		child = add_new_child(directory, name, -1, DT_REG);
+		entry = talloc_size(names, sizeof(Entry) + strlen(name) + 1);
+		if (names[i] == NULL || child == NULL || entry == NULL)
+			exit(EXIT_FAILURE);
+
+		strcpy(entry->name, name);
+		HASH_ADD_KEYPTR(hh, table, entry->name, strlen(entry->name), entry);
+
+		index_size += node_footprint(child);
+	}
+
+	/* What the index costs on top of the nodes themselves.  */
+	index_size = get_memory_usage(directory) - index_size
+		+ nb_children * (sizeof(child->hash) + sizeof(child->position));
+	hash_size = HASH_OVERHEAD(hh, table);
+
+	/* Each name is probed at least once.  */
+	nb_probes = MAX(nb_children, nb_lookups - nb_lookups % nb_children);
+
+	start = now();
+	for (i = 0; i < nb_probes; i++) {
+		child = find_in_index(directory, names[i % nb_children], -1);
+		if (child == NULL)
+			exit(EXIT_FAILURE);
+	}
+	index_hit = now() - start;
+
+	start = now();
+	for (i = 0; i < nb_probes; i++) {
+		const char *name = names[i % nb_children];
+
+		HASH_FIND(hh, table, name, strlen(name), entry);
+		if (entry == NULL)
+			exit(EXIT_FAILURE);
+	}
+	hash_hit = now() - start;
+
+	/* Turn every name into one that is missing.  */
+	for (i = 0; i < nb_children; i++)
+		names[i][0] = 'm';
+
+	start = now();
+	for (i = 0; i < nb_probes; i++) {
+		child = find_in_index(directory, names[i % nb_children], -1);
+		if (child != NULL)
+			exit(EXIT_FAILURE);
+	}
+	index_miss = now() - start;
+
+	start = now();
+	for (i = 0; i < nb_probes; i++) {
+		const char *name = names[i % nb_children];
+
+		HASH_FIND(hh, table, name, strlen(name), entry);
+		if (entry != NULL)
+			exit(EXIT_FAILURE);
+	}
+	hash_miss = now() - start;
+
+	printf("child_index children=%zu hit_ns=%.1f miss_ns=%.1f bytes_per_child=%.1f "
+		"uthash_hit_ns=%.1f uthash_miss_ns=%.1f uthash_bytes_per_child=%.1f\n",
+		nb_children, index_hit / nb_probes, index_miss / nb_probes,
+		(double) index_size / nb_children, hash_hit / nb_probes, hash_miss / nb_probes,
+		(double) hash_size / nb_children);
+
+	HASH_CLEAR(hh, table);
+	(void) delete_tree(directory);
+}
+
+/**
+ * Measure the walkers rebuilt on visit_tree() over a synthetic tree
+ * of @nb_nodes nodes below its root, either chained @nb_nodes levels
+ * deep, or all children of the root.
+ */
+static void bench_visit(size_t nb_nodes, bool is_deep)
+{
+	double start;
+	double flush_path_ns;
+	double print_ns;
+	double flush_ns;
+	Node *directory;
+	Node *node;
+	FILE *null;
+	size_t i;
+
+	directory = new_node(NULL, "/", -1, DT_DIR);
+	null = fopen("/dev/null", "w");
+	if (directory == NULL || null == NULL)
+		exit(EXIT_FAILURE);
+
+	node = directory;
+	for (i = 0; i < nb_nodes; i++) {
+		char name[NAME_MAX];
+		Node *child;
+
+		make_name(name, sizeof(name), 'v', i);
+		child = add_new_child(node, name, -1, DT_DIR);
+		if (child == NULL)
+			exit(EXIT_FAILURE);
+
+		if (is_deep)
+			node = child;
+	}
+
+	start = now();
+	flush_path(directory, VIRTUAL_PATH);
+	flush_path_ns = now() - start;
+
+	start = now();
+	print_tree(directory, null);
+	print_ns = now() - start;
+
+	start = now();
+	(void) flush_children(directory, false);
+	flush_ns = now() - start;
+
+	printf("visit shape=%s nodes=%zu flush_path_ns_per_node=%.1f print_tree_ns_per_node=%.1f "
+		"flush_children_ns_per_node=%.1f\n", is_deep ? "deep" : "wide", nb_nodes,
+		flush_path_ns / nb_nodes, print_ns / nb_nodes, flush_ns / nb_nodes);
+
+	(void) fclose(null);
+	(void) delete_tree(directory);
+}
+
+/**
+ * Split @path as find_node_() did before next_component(): one scan
+ * for slashes, one for the component, one comparison with "." and
+ * "..", then hashing one byte at a time.  This function returns a
+ * value that depends on every hash, so as nothing is optimized out.
+ */
+static uint32_t split_bytewise(const char *path)
+{
+	uint32_t result = 0;
+
+	while (path[0] != '\0') {
+		uint32_t hash = 2166136261U;
+		size_t length;
+		size_t i;
+
+		path += strspn(path, "/");
+		length = strcspn(path, "/");
+
+		if (   (length == 1 && strncmp(path, ".", length) == 0)
+		    || (length == 2 && strncmp(path, "..", length) == 0))
+			result++;
+
+		for (i = 0; i < length; i++)
+			hash = (hash ^ (unsigned char) path[i]) * 16777619U;
+
+		result ^= hash;
+		path += length;
+	}
+
+	return result;
+}
+
+/**
+ * Compare the splitting of paths of @path_length bytes, made of
+ * components of 1 to 16 bytes, by next_component() and as it was
+ * done before.
+ */
+static void bench_components(size_t path_length)
+{
+	const size_t nb_samples = 256;
+	volatile uint32_t sink = 0;
+	double bytewise;
+	double vector;
+	size_t nb_splits;
+	unsigned int seed = path_length;
+	char **samples;
+	double start;
+	size_t i;
+
+	samples = talloc_array(NULL, char *, nb_samples);
+	if (samples == NULL)
+		exit(EXIT_FAILURE);
+
+	for (i = 0; i < nb_samples; i++) {
+		size_t length = 0;
+
+		samples[i] = talloc_size(samples, path_length + 1);
+		if (samples[i] == NULL)
+			exit(EXIT_FAILURE);
+
+		while (length < path_length) {
+			size_t size = 1 + rand_r(&seed) % 16;
+			size_t end = MIN(length + size, path_length);
+
+			samples[i][length++] = '/';
+			for (; length < end; length++)
+				samples[i][length] = 'a' + rand_r(&seed) % 26;
+		}
+		samples[i][path_length] = '\0';
+	}
+
+	nb_splits = nb_lookups - nb_lookups % nb_samples;
+
+	start = now();
+	for (i = 0; i < nb_splits; i++)
+		sink ^= split_bytewise(samples[i % nb_samples]);
+	bytewise = now() - start;
+
+	start = now();
+	for (i = 0; i < nb_splits; i++) {
+		const char *path = samples[i % nb_samples];
+		Component component;
+
+		while (path[0] != '\0') {
+			path = next_component(path, &component);
+			sink ^= component.hash + component.kind;
+		}
+	}
+	vector = now() - start;
+
+	printf("components path_length=%zu ops=%zu ns_per_path=%.1f bytewise_ns_per_path=%.1f\n",
+		path_length, nb_splits, vector / nb_splits, bytewise / nb_splits);
+
+	talloc_free(samples);
+}
+
+/**
+ * Diverge the views handled by the thread of index @data: one of
+ * their directories is bound to the root of the benchmarked
+ * directory, then VIEW_LOOKUPS paths are looked up in each view.
+ */
+static void *diverge_thread(void *data)
+{
+	size_t index = (size_t) data;
+	size_t i;
+	size_t j;
+	int error;
+
+	pthread_barrier_wait(&barrier);
+
+	for (i = index; i < nb_views; i += nb_view_threads) {
+		Node *node;
+
+		node = find_node(views[i], views[i], paths[1 + i % (nb_paths - 1)], 0, &error);
+		if (node != NULL && node->type == DT_DIR)
+			(void) set_actual_path(node, directory);
+
+		/* Paths are spread over the whole tree.  */
+		for (j = 0; j < VIEW_LOOKUPS; j++) {
+			const char *path = paths[(i + j * 7919) % nb_paths];
+			(void) find_node(views[i], views[i], path, 0, &error);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Create @nb_views views of the benchmarked directory, either
+ * cloned from @origin, an entirely filled tree, or new trees if
+ * @origin is NULL.  They are then diverged in @nb_threads threads,
+ * see diverge_thread().  The creation and lookup times, in
+ * nanoseconds per operation, and the memory used per view are
+ * returned in @results.
+ */
+static void diverge_views(Node *origin, size_t nb_threads, double results[3])
+{
+	pthread_t *threads;
+	size_t usage = 0;
+	double start;
+	size_t i;
+
+	views = talloc_array(NULL, Node *, nb_views);
+	threads = talloc_array(NULL, pthread_t, nb_threads);
+	if (views == NULL || threads == NULL)
+		exit(EXIT_FAILURE);
+
+	start = now();
+	for (i = 0; i < nb_views; i++) {
+		views[i] = (origin != NULL ? clone_tree(origin) : new_tree());
+		if (views[i] == NULL)
+			exit(EXIT_FAILURE);
+	}
+	results[0] = (now() - start) / nb_views;
+
+	nb_view_threads = nb_threads;
+	pthread_barrier_init(&barrier, NULL, nb_threads + 1);
+
+	for (i = 0; i < nb_threads; i++)
+		pthread_create(&threads[i], NULL, diverge_thread, (void *) i);
+
+	pthread_barrier_wait(&barrier);
+	start = now();
+
+	for (i = 0; i < nb_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	results[1] = (now() - start) / (nb_views * VIEW_LOOKUPS) * nb_threads;
+	pthread_barrier_destroy(&barrier);
+
+	for (i = 0; i < nb_views; i++) {
+		usage += get_memory_usage(views[i]);
+		(void) delete_tree(views[i]);
+	}
+	results[2] = (double) usage / nb_views;
+
+	talloc_free(threads);
+	TALLOC_FREE(views);
+}
+
+/**
+ * Compare @count views cloned from an entirely filled tree with as
+ * many new trees, when they diverge concurrently in @nb_threads
+ * threads.  This function prints one line of results.
+ */
+static void bench_clone(size_t count, size_t nb_threads)
+{
+	double cloned[3];
+	double fresh[3];
+	Node *origin;
+
+	if (nb_paths < 2)
+		return;
+
+	origin = new_tree();
+	(void) fill_all(origin, false);
+
+	nb_views = count;
+	diverge_views(origin, nb_threads, cloned);
+
+	nb_views = count;
+	diverge_views(NULL, nb_threads, fresh);
+
+	printf("clone_tree views=%zu threads=%zu clone_ns_per_op=%.1f lookup_ns_per_op=%.1f "
+		"bytes_per_view=%.0f new_ns_per_op=%.1f new_lookup_ns_per_op=%.1f "
+		"new_bytes_per_view=%.0f origin_bytes=%zu\n",
+		count, nb_threads, cloned[0], cloned[1], cloned[2],
+		fresh[0], fresh[1], fresh[2], get_memory_usage(origin));
+
+	(void) delete_tree(origin);
+}
+
+/**
+ * Evaluate @node as a symbolic link to @data, as /proc/self is.
+ */
+static int evaluate_link(Node *node, Evaluation *evaluation, void *data)
+{
+	(void) node;
+
+	return set_evaluated_symlink(evaluation, data);
+}
+
+/**
+ * Look up the children of a top-level directory through another
+ * one, evaluated as a symbolic link to the former with a lifetime
+ * of @ttl nanoseconds.  A lifetime of 1 nanosecond makes each lookup
+ * call the evaluator.  This function prints one line of results.
+ */
+static void bench_evaluator(uint64_t ttl)
+{
+	char pattern[NAME_MAX + 2];
+	char target[NAME_MAX + 2];
+	const Node *nodes[2];
+	size_t nb_children;
+	TreeStats stats;
+	double start;
+	Node *child;
+	Node *tree;
+	size_t i;
+	int error;
+
+	tree = new_tree();
+	(void) fill_all(tree, false);
+
+	/* The first directory is evaluated as a link to the second.  */
+	i = 0;
+	FOR_EACH_CHILD(child, tree) {
+		if (child->type == DT_DIR && i < 2)
+			nodes[i++] = child;
+	}
+
+	if (i < 2 || nodes[1]->children.nb_nodes == 0) {
+		(void) delete_tree(tree);
+		return;
+	}
+
+	snprintf(pattern, sizeof(pattern), "/%s", nodes[0]->name);
+	snprintf(target, sizeof(target), "/%s", nodes[1]->name);
+	nb_children = nodes[1]->children.nb_nodes;
+
+	if (register_evaluator(tree, pattern, evaluate_link, target, ttl) < 0)
+		exit(EXIT_FAILURE);
+
+	start = now();
+	for (i = 0; i < nb_lookups; i++) {
+		char path[PATH_MAX];
+
+		snprintf(path, sizeof(path), "%s/%s", pattern,
+			nodes[1]->children.nodes[i % nb_children]->name);
+		(void) find_node(tree, tree, path, 0, &error);
+	}
+
+	get_tree_stats(tree, &stats);
+
+	printf("evaluator ttl_ns=%" PRIu64 " ops=%zu ns_per_op=%.1f calls=%" PRIu64 " hits=%" PRIu64 "\n",
+		ttl, nb_lookups, (now() - start) / nb_lookups,
+		stats.counters[STAT_EVALUATIONS], stats.counters[STAT_EVALUATION_HITS]);
+
+	(void) delete_tree(tree);
+}
+
+int main(int argc, char *argv[])
+{
+	char template[] = "/tmp/vfs-bench.XXXXXX";
+	unsigned int seed = 0;
+	bool generated = false;
+	size_t max_threads;
+	size_t batch_size;
+	size_t nb_threads;
+	size_t nb_nodes;
+	size_t i;
+	int option;
+
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((option = getopt(argc, argv, "f:d:s:l:t:n:p:")) != -1) {
+		switch (option) {
+		case 'f': fanout          = strtoul(optarg, NULL, 0); break;
+		case 'd': depth           = strtoul(optarg, NULL, 0); break;
+		case 's': symlink_density = strtoul(optarg, NULL, 0); break;
+		case 'l': name_length     = strtoul(optarg, NULL, 0); break;
+		case 't': max_threads     = strtoul(optarg, NULL, 0); break;
+		case 'n': nb_lookups      = strtoul(optarg, NULL, 0); break;
+		case 'p': max_paths       = strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "usage: %s [-f fanout] [-d depth] [-s symlink_percent] "
+				"[-l name_length] [-t max_threads] [-n lookups] [-p max_paths] "
+				"[directory]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind < argc)
+		directory = argv[optind];
+	else {
+		int status;
+
+		directory = mkdtemp(template);
+		if (directory == NULL) {
+			perror("mkdtemp");
+			exit(EXIT_FAILURE);
+		}
+		generated = true;
+
+		status = generate_tree(directory, 0, &seed);
+		if (status < 0) {
+			fprintf(stderr, "can't generate tree in %s: %s\n", directory, strerror(-status));
+			(void) nftw(directory, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	paths = talloc_array(NULL, const char *, max_paths);
+	missing_paths = talloc_array(NULL, const char *, max_paths);
+	if (paths == NULL || missing_paths == NULL)
+		exit(EXIT_FAILURE);
+
+	root = new_tree();
+	nb_nodes = fill_all(root, true);
+	if (nb_paths == 0)
+		exit(EXIT_FAILURE);
+
+	if (generated)
+		printf("tree directory=%s fanout=%zu depth=%zu symlink_percent=%zu name_length=%zu nodes=%zu\n",
+			directory, fanout, depth, symlink_density, name_length, nb_nodes);
+	else
+		printf("tree directory=%s nodes=%zu\n", directory, nb_nodes);
+
+	bench_fill(0);
+	bench_fill(1024);
+	bench_get_path();
+	bench_set_actual_path();
+	bench_rebind();
+	bench_flush_delete();
+	bench_snapshot();
+
+	for (nb_threads = 1; nb_threads <= max_threads; nb_threads *= 2)
+		bench_prefetch(nb_threads);
+
+	for (nb_threads = 1; nb_threads <= max_threads; nb_threads *= 2) {
+		bench_lookups(nb_threads, LOOKUP_COLD);
+		bench_lookups(nb_threads, LOOKUP_HIT);
+		bench_lookups(nb_threads, LOOKUP_MISS);
+	}
+
+	bench_translate();
+
+	for (i = 1; i <= 1000; i *= 10)
+		bench_detranslate(i);
+
+	bench_listing(1024);
+	bench_listing(32 * 1024);
+
+	for (batch_size = 2; batch_size <= 32; batch_size *= 4) {
+		bench_find_nodes(batch_size, LOOKUP_HIT);
+		bench_find_nodes(batch_size, LOOKUP_MISS);
+	}
+
+	for (i = 1; i <= 4096; i *= 4)
+		bench_index(i);
+
+	for (i = 40; i <= 200; i += 80)
+		bench_components(i);
+
+	bench_visit(10000, true);
+	bench_visit(1000000, false);
+
+	bench_clone(256, 1);
+	bench_clone(256, max_threads);
+
+	bench_evaluator(0);
+	bench_evaluator(1000000);
+	bench_evaluator(1);
+
+	talloc_free(paths);
+	talloc_free(missing_paths);
+	delete_tree(root);
+
+	if (generated)
+		(void) nftw(directory, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+	exit(EXIT_SUCCESS);
+}
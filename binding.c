@@ -0,0 +1,397 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <string.h>	/* str*(3), memcpy(3), */
+#include <limits.h>	/* PATH_MAX, */
+#include <assert.h>	/* assert(3), */
+#include <errno.h>	/* E*, */
+#include <dirent.h>	/* DT_*, */
+#include <talloc.h>
+#include "vfs/binding.h"
+#include "vfs/node.h"
+#include "vfs/tree.h"
+#include "vfs/path.h"
+#include "vfs/index.h"
+#include "vfs/component.h"
+
+/* Entry of the reverse index of a tree: a special node by its
+ * actual path, see detranslate_path().  Several nodes might be bound
+ * to the same actual path, they are in the same chain then.  */
+typedef struct binding
+{
+	Node *node;
+	size_t length;
+	uint32_t hash;
+	struct binding *next;
+} Binding;
+
+/* Virtual path, actual path and type of a bound node, as copied
+ * from a tree to its clone, see copy_bindings().  */
+typedef struct
+{
+	char *virtual;
+	char *actual;
+	int type;
+} BindingCopy;
+
+/**
+ * Get the length of @path without its trailing separators, except
+ * the one of "/".
+ */
+static size_t get_key_length(const char *path)
+{
+	size_t length = strlen(path);
+
+	while (length > 1 && path[length - 1] == '/')
+		length--;
+
+	return length;
+}
+
+/**
+ * Allocate the entry of @node in the reverse index of its tree, so
+ * as index_binding() can't fail once @node is bound.  This function
+ * returns NULL if there's not enough memory.
+ */
+Binding *new_binding(Node *node)
+{
+	Binding *binding;
+
+	binding = talloc_zero(node->tree, Binding);
+	if (binding == NULL)
+		return NULL;
+
+	talloc_set_name_const(binding, "$binding");
+
+	return binding;
+}
+
+/**
+ * Double the number of buckets of @tree's reverse index, if
+ * possible; chains are only longer otherwise.
+ */
+static void grow_bindings(Tree *tree)
+{
+	size_t nb_buckets = tree->bindings.nb_buckets != 0 ? 2 * tree->bindings.nb_buckets : 16;
+	Binding **buckets;
+	size_t i;
+
+	buckets = talloc_zero_array(tree, Binding *, nb_buckets);
+	if (buckets == NULL)
+		return;
+
+	talloc_set_name_const(buckets, "$bindings");
+
+	for (i = 0; i < tree->bindings.nb_buckets; i++) {
+		Binding *binding = tree->bindings.buckets[i];
+
+		while (binding != NULL) {
+			Binding *next = binding->next;
+			size_t index = binding->hash & (nb_buckets - 1);
+
+			binding->next = buckets[index];
+			buckets[index] = binding;
+
+			binding = next;
+		}
+	}
+
+	talloc_free(tree->bindings.buckets);
+	tree->bindings.buckets    = buckets;
+	tree->bindings.nb_buckets = nb_buckets;
+}
+
+/**
+ * Add @node, a special node, to the reverse index of its tree
+ * through @binding, as allocated by new_binding().  The tree has to
+ * be write-locked.
+ */
+void index_binding(Node *node, Binding *binding)
+{
+	Tree *tree = node->tree;
+	size_t index;
+
+	assert(is_write_locked(tree));
+	assert(node->special);
+
+	if (tree->bindings.nb_bindings >= tree->bindings.nb_buckets)
+		grow_bindings(tree);
+
+	if (tree->bindings.nb_buckets == 0) {
+		talloc_free(binding);
+		return;
+	}
+
+	binding->node   = node;
+	binding->length = get_key_length(node->path_.actual);
+	binding->hash   = hash_name(node->path_.actual, binding->length);
+
+	index = binding->hash & (tree->bindings.nb_buckets - 1);
+	binding->next = tree->bindings.buckets[index];
+	tree->bindings.buckets[index] = binding;
+
+	tree->bindings.nb_bindings++;
+}
+
+/**
+ * Remove @node from the reverse index of its tree, if it is there.
+ * The tree has to be write-locked.
+ */
+void unindex_binding(Node *node)
+{
+	Tree *tree = node->tree;
+	Binding **link;
+	uint32_t hash;
+
+	assert(is_write_locked(tree));
+
+	if (!node->special || tree->bindings.nb_buckets == 0)
+		return;
+
+	hash = hash_name(node->path_.actual, get_key_length(node->path_.actual));
+
+	for (link = &tree->bindings.buckets[hash & (tree->bindings.nb_buckets - 1)];
+	     *link != NULL; link = &(*link)->next) {
+		Binding *binding = *link;
+
+		if (binding->node != node)
+			continue;
+
+		*link = binding->next;
+		talloc_free(binding);
+		tree->bindings.nb_bindings--;
+		return;
+	}
+}
+
+/**
+ * Bind in @node's tree the nodes at the same virtual paths as the
+ * ones bound in @from's tree, to the same actual paths, see
+ * clone_tree().  Missing nodes are created on the way.  This
+ * function returns -errno if an error occurred, otherwise 0.
+ */
+int copy_bindings(Node *node, const Node *from)
+{
+	Tree *tree = from->tree;
+	BindingCopy *copies;
+	size_t nb_bindings;
+	size_t nb_copies = 0;
+	char path[PATH_MAX];
+	int status = 0;
+	size_t i;
+
+	/* Both trees can't be locked at the same time.  */
+	read_lock_tree(tree);
+
+	nb_bindings = tree->bindings.nb_bindings;
+	copies = talloc_zero_array(NULL, BindingCopy, nb_bindings);
+	for (i = 0; copies != NULL && i < tree->bindings.nb_buckets; i++) {
+		const Binding *binding;
+
+		for (binding = tree->bindings.buckets[i]; binding != NULL; binding = binding->next) {
+			if (render_path(binding->node, VIRTUAL_PATH, path, sizeof(path)) < 0)
+				continue;
+
+			copies[nb_copies].virtual = talloc_strdup(copies, path);
+			copies[nb_copies].actual  = talloc_strdup(copies, binding->node->path_.actual);
+			copies[nb_copies].type    = binding->node->type;
+			if (copies[nb_copies].virtual == NULL || copies[nb_copies].actual == NULL) {
+				TALLOC_FREE(copies);
+				break;
+			}
+			nb_copies++;
+		}
+	}
+
+	read_unlock_tree(tree);
+
+	if (copies == NULL)
+		return nb_bindings != 0 ? -ENOMEM : 0;
+
+	write_lock_tree(node->tree);
+
+	for (i = 0; i < nb_copies && status >= 0; i++) {
+		const char *cursor = copies[i].virtual;
+		Node *copy = node;
+
+		while (cursor[0] != '\0' && copy != NULL) {
+			Component component;
+			Node *child;
+
+			cursor = next_component(cursor, &component);
+			if (component.length == 0)
+				continue;
+
+			child = find_hashed_in_index(copy, component.name,
+						component.length, component.hash);
+			if (child == NULL)
+				child = add_new_child(copy, component.name, component.length,
+						cursor[0] == '\0' ? copies[i].type : DT_DIR);
+			copy = child;
+		}
+
+		status = (copy != NULL ? set_actual_path(copy, copies[i].actual) : -ENOMEM);
+	}
+
+	write_unlock_tree(node->tree);
+
+	talloc_free(copies);
+
+	return status;
+}
+
+/**
+ * Check whether the virtual path made of @node's one and @suffix
+ * crosses another binding, in which case it doesn't lead to the
+ * actual path of @node followed by @suffix.  Bound nodes are never
+ * flushed, so only the nodes in memory are checked.
+ */
+static bool is_shadowed(const Node *node, const char *suffix)
+{
+	while (1) {
+		Component component;
+
+		suffix = next_component(suffix, &component);
+		if (component.length == 0)
+			return false;
+
+		if (component.kind != COMPONENT_NAME)
+			return true;
+
+		node = find_hashed_in_index(node, component.name, component.length, component.hash);
+		if (node == NULL)
+			return false;
+
+		if (node->special)
+			return true;
+	}
+}
+
+/**
+ * Write in @buffer, of @size bytes, the virtual path of @node
+ * followed by @suffix, where @node is bound to an actual path of
+ * @length bytes.  This function returns -ERANGE if @buffer is too
+ * small, otherwise the length of the virtual path.
+ */
+static ssize_t join_binding(const Node *node, size_t length, const char *suffix,
+			char *buffer, size_t size)
+{
+	ssize_t prefix_length;
+	size_t suffix_length;
+
+	prefix_length = render_path(node, VIRTUAL_PATH, buffer, size);
+	if (prefix_length < 0)
+		return prefix_length;
+
+	/* The separator is already provided by the "/" prefix, or by
+	 * the "/" binding.  */
+	if (strcmp(buffer, "/") == 0 && suffix[0] == '/')
+		prefix_length = 0;
+	if (length == 1 && suffix[0] != '\0' && prefix_length > 1)
+		buffer[prefix_length++] = '/';
+
+	suffix_length = strlen(suffix);
+	if (prefix_length + suffix_length >= size)
+		return -ERANGE;
+
+	memcpy(buffer + prefix_length, suffix, suffix_length + 1);
+
+	return prefix_length + suffix_length;
+}
+
+/**
+ * Write in @buffer, of @size bytes, the virtual path in @root
+ * file-system that leads to the actual @path, that is, the inverse
+ * of translate_path().  The binding that applies is the one with the
+ * longest actual path that prefixes @path, unless another binding
+ * is crossed below it: prefixes of @path are probed from the longest
+ * one in the reverse index of the tree, so this doesn't depend on
+ * the number of bindings.  An unbound @root is handled as if it
+ * were bound to its own actual path.  @path has to be canonical, as
+ * returned by getcwd(3).  This function returns -ENOENT if no
+ * binding applies, -ERANGE if @buffer is too small, otherwise the
+ * length of the virtual path.
+ */
+ssize_t detranslate_path(Node *root, const char *path, char *buffer, size_t size)
+{
+	Tree *tree = root->tree;
+	ssize_t status = -ENOENT;
+	size_t length;
+
+	if (path[0] != '/')
+		return -EINVAL;
+
+	read_lock_tree(tree);
+
+	if (tree->bindings.nb_buckets == 0)
+		goto unbound;
+
+	length = strlen(path);
+	while (1) {
+		const char *suffix = path + length;
+		uint32_t hash = hash_name(path, length);
+		const Binding *binding;
+
+		binding = tree->bindings.buckets[hash & (tree->bindings.nb_buckets - 1)];
+		for (; binding != NULL; binding = binding->next) {
+			if (binding->hash != hash || binding->length != length
+			    || memcmp(binding->node->path_.actual, path, length) != 0)
+				continue;
+
+			if (is_shadowed(binding->node, suffix))
+				continue;
+
+			status = join_binding(binding->node, length, suffix, buffer, size);
+			goto end;
+		}
+
+		if (length == 1)
+			break;
+
+		/* Probe the next shorter prefix that ends right
+		 * before a separator, or "/" finally.  */
+		do
+			length--;
+		while (length > 1 && path[length] != '/');
+	}
+
+unbound:
+	/* An unbound root is not in the reverse index, still its
+	 * actual path is its name, as "/", see measure_path().  */
+	if (!root->special) {
+		char actual[PATH_MAX];
+
+		if (render_path(root, ACTUAL_PATH, actual, sizeof(actual)) < 0)
+			goto end;
+
+		length = get_key_length(actual);
+		if (   strncmp(path, actual, length) == 0
+		    && (length == 1 || path[length] == '\0' || path[length] == '/')
+		    && !is_shadowed(root, path + length))
+			status = join_binding(root, length, path + length, buffer, size);
+	}
+
+end:
+	read_unlock_tree(tree);
+
+	return status;
+}
@@ -0,0 +1,37 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_BINDING
+#define PROOT_VFS_BINDING
+
+#include <sys/types.h>	/* ssize_t, */
+#include "vfs/node.h"
+
+struct binding;
+
+extern struct binding *new_binding(Node *node);
+extern void index_binding(Node *node, struct binding *binding);
+extern void unindex_binding(Node *node);
+extern int copy_bindings(Node *node, const Node *from);
+extern ssize_t detranslate_path(Node *root, const char *path, char *buffer, size_t size);
+
+#endif /* PROOT_VFS_BINDING */
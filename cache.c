@@ -0,0 +1,246 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdint.h>	/* uint*_t, uintptr_t, */
+#include <stdbool.h>	/* bool, */
+#include <fcntl.h>	/* O_NOFOLLOW, O_CREAT, */
+#include <errno.h>	/* ENOMEM, */
+#include <talloc.h>
+#include "vfs/cache.h"
+#include "vfs/node.h"
+#include "vfs/tree.h"
+
+/* Number of slots, it has to be a power of 2.  */
+#define LOOKUP_CACHE_SIZE 1024
+
+/* Longest normalized path that can be cached, chosen to make a slot
+ * fit in 128 bytes.  */
+#define LOOKUP_CACHE_PATH_MAX 82
+
+struct lookup_cache_slot
+{
+	const Node *root;
+	const Node *start;
+	Node *node;
+	size_t generation;
+
+	/* Odd while this slot is being written, see
+	 * lookup_cache_put().  */
+	uint32_t sequence;
+
+	uint32_t hash;
+	int flags;
+	uint16_t length;
+	char path[LOOKUP_CACHE_PATH_MAX];
+};
+
+/**
+ * Mix @byte into @hash, as in FNV-1a.
+ */
+static inline uint32_t hash_byte(uint32_t hash, unsigned char byte)
+{
+	return (hash ^ byte) * 16777619U;
+}
+
+/**
+ * Compute in @key->hash and @key->length the hash and the length of
+ * @key->path once consecutive slashes are collapsed, mixed with
+ * @key->root, @key->start and @key->flags.  This function
+ * returns false if this path is too long to be cached.
+ */
+static bool hash_key(LookupKey *key)
+{
+	uintptr_t root  = (uintptr_t) key->root;
+	uintptr_t start = (uintptr_t) key->start;
+	unsigned int flags = key->flags;
+	uint32_t hash = 2166136261U;
+	const char *cursor;
+	size_t length = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(root); i++)
+		hash = hash_byte(hash, root >> (i * 8));
+
+	for (i = 0; i < sizeof(start); i++)
+		hash = hash_byte(hash, start >> (i * 8));
+
+	for (i = 0; i < sizeof(flags); i++)
+		hash = hash_byte(hash, flags >> (i * 8));
+
+	for (cursor = key->path; *cursor != '\0'; cursor++) {
+		if (cursor[0] == '/' && cursor[1] == '/')
+			continue;
+
+		if (length == LOOKUP_CACHE_PATH_MAX)
+			return false;
+
+		hash = hash_byte(hash, *cursor);
+		length++;
+	}
+
+	key->hash   = hash;
+	key->length = length;
+
+	return true;
+}
+
+/**
+ * Check whether @slot->path is equal to @path once consecutive
+ * slashes are collapsed.
+ */
+static bool same_path(const struct lookup_cache_slot *slot, const char *path)
+{
+	size_t i = 0;
+
+	for (; *path != '\0'; path++) {
+		if (path[0] == '/' && path[1] == '/')
+			continue;
+
+		if (i == slot->length || slot->path[i] != *path)
+			return false;
+		i++;
+	}
+
+	return i == slot->length;
+}
+
+/**
+ * Allocate the lookup cache of @tree.  This is not done lazily since
+ * this cache is read and written without locking the tree.  This
+ * function returns -ENOMEM if there's not enough memory, otherwise
+ * 0.
+ */
+int init_lookup_cache(Tree *tree)
+{
+	tree->lookup_cache.slots = talloc_zero_array(tree, struct lookup_cache_slot,
+						LOOKUP_CACHE_SIZE);
+	if (tree->lookup_cache.slots == NULL)
+		return -ENOMEM;
+
+	talloc_set_name_const(tree->lookup_cache.slots, "$lookup_cache");
+
+	return 0;
+}
+
+/**
+ * Get from @start's tree the node previously cached for @path in
+ * @root file-system, relatively to @start, and @flags.  The root is
+ * part of the key since absolute symlinks and ".." components met
+ * during a relative lookup depend on it.  This function returns NULL if
+ * there's no such node; in this case, @key can be used later by
+ * lookup_cache_put() to cache the result of the full lookup.  The
+ * tree doesn't have to be locked: each slot is protected by a
+ * sequence counter, readers retry -- actually miss -- if this slot
+ * was written in the meantime.
+ */
+Node *lookup_cache_get(LookupKey *key, Node *root, Node *start, const char *path, int flags)
+{
+	Tree *tree = start->tree;
+	struct lookup_cache_slot *slot;
+	uint32_t sequence;
+	Node *node = NULL;
+
+	key->slot  = NULL;
+	key->root  = root;
+	key->start = start;
+	key->path  = path;
+	key->flags = flags & (O_NOFOLLOW | O_CREAT);
+
+	if (!hash_key(key))
+		goto miss;
+
+	slot = &tree->lookup_cache.slots[key->hash & (LOOKUP_CACHE_SIZE - 1)];
+	key->slot = slot;
+
+	sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+	if ((sequence & 1) != 0)
+		goto miss;
+
+	if (   slot->generation == get_generation(tree)
+	    && slot->hash   == key->hash
+	    && slot->root   == root
+	    && slot->start  == start
+	    && slot->flags  == key->flags
+	    && slot->length == key->length
+	    && same_path(slot, path))
+		node = slot->node;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (node == NULL || __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence)
+		goto miss;
+
+	__atomic_add_fetch(&tree->lookup_cache.hits, 1, __ATOMIC_RELAXED);
+	return node;
+
+miss:
+	__atomic_add_fetch(&tree->lookup_cache.misses, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/**
+ * Cache @node as the result of the lookup described by @key, as
+ * previously computed by lookup_cache_get().  The tree has to be
+ * locked, at least for reading, so as @node is not flushed in the
+ * meantime.
+ */
+void lookup_cache_put(const LookupKey *key, Node *node)
+{
+	struct lookup_cache_slot *slot = key->slot;
+	const char *cursor;
+	uint32_t sequence;
+	size_t i = 0;
+
+	if (slot == NULL)
+		return;
+
+	/* Give up if another thread is writing this slot.  */
+	sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+	if ((sequence & 1) != 0
+	    || !__atomic_compare_exchange_n(&slot->sequence, &sequence, sequence + 1,
+					false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+
+	for (cursor = key->path; *cursor != '\0'; cursor++) {
+		if (cursor[0] == '/' && cursor[1] == '/')
+			continue;
+		slot->path[i++] = *cursor;
+	}
+
+	slot->root       = key->root;
+	slot->start      = key->start;
+	slot->node       = node;
+	slot->generation = get_generation(node->tree);
+	slot->hash       = key->hash;
+	slot->length     = key->length;
+	slot->flags      = key->flags;
+
+	__atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Fill @stats with the lookup cache counters of @node's tree.
+ */
+void get_lookup_cache_stats(const Node *node, LookupCacheStats *stats)
+{
+	stats->hits   = __atomic_load_n(&node->tree->lookup_cache.hits, __ATOMIC_RELAXED);
+	stats->misses = __atomic_load_n(&node->tree->lookup_cache.misses, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,53 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_CACHE
+#define PROOT_VFS_CACHE
+
+#include <stdint.h>	/* uint*_t, */
+#include <stddef.h>	/* size_t, */
+#include "vfs/node.h"
+
+/* Key of a full-path lookup, computed once by lookup_cache_get()
+ * then reused by lookup_cache_put().  */
+typedef struct {
+	struct lookup_cache_slot *slot;
+	const Node *root;
+	const Node *start;
+	const char *path;
+	size_t length;
+	uint32_t hash;
+	int flags;
+} LookupKey;
+
+typedef struct {
+	size_t hits;
+	size_t misses;
+} LookupCacheStats;
+
+extern int init_lookup_cache(struct tree *tree);
+extern Node *lookup_cache_get(LookupKey *key, Node *root, Node *start, const char *path,
+			int flags);
+extern void lookup_cache_put(const LookupKey *key, Node *node);
+extern void get_lookup_cache_stats(const Node *node, LookupCacheStats *stats);
+
+#endif /* PROOT_VFS_CACHE */
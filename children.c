@@ -20,117 +20,955 @@
  * 02110-1301 USA.
  */
 
-#include <dirent.h>	/* DIR, DT_DIR, struct dirent, opendir(3), closedir(3), */
+#include <sys/syscall.h>	/* SYS_getdents64, */
+#include <sys/stat.h>	/* statx(2), */
+#include <limits.h>	/* PATH_MAX, */
+#include <unistd.h>	/* syscall(2), close(2), */
+#include <fcntl.h>	/* open(2), O_*, */
+#include <dirent.h>	/* DT_*, IFTODT, */
+#include <stdint.h>	/* *int*_t, */
+#include <stdbool.h>	/* bool, */
 #include <assert.h>	/* assert(3), */
 #include <errno.h>	/* errno(3), ENOMEM, */
 #include <string.h>	/* str*(), */
+#include <stdlib.h>	/* malloc(3), realloc(3), free(3), */
+#include <pthread.h>	/* pthread_*, */
 #include <stdio.h>	/* fprintf(3), */
 #include <talloc.h>
-#include <uthash.h>
 #include "vfs/children.h"
 #include "vfs/path.h"
 #include "vfs/node.h"
+#include "vfs/tree.h"
+#include "vfs/memory.h"
+#include "vfs/snapshot.h"
+#include "vfs/watch.h"
+#include "vfs/descriptor.h"
+#include "vfs/attributes.h"
+#include "vfs/visit.h"
+#include "vfs/stats.h"
+#include "vfs/clone.h"
+
+/* Size of the buffer initially used to read directory entries, it
+ * grows as needed so as all entries are read in one batch.  */
+#define DIRENTS_BUFFER_SIZE (32 * 1024)
 
 /**
- * Fill @parent->children with the directory entries of @parent actual
- * path.  This function return -errno if an error occurred, otherwise
- * 0.
+ * Read all the directory entries of @fd into *@buffer, allocated
+ * with malloc(3) since no talloc context can be used without holding
+ * the tree lock.  This function returns -errno if an error occurred,
+ * otherwise the number of bytes filled in *@buffer.
  */
-int fill_children(Node *parent)
+static ssize_t read_dirents(int fd, char **buffer)
 {
-	DIR *dir = NULL;
+	size_t size = DIRENTS_BUFFER_SIZE;
+	size_t used = 0;
 
-	struct dirent *entry;
-	const char *path;
+	*buffer = malloc(size);
+	if (*buffer == NULL)
+		return -ENOMEM;
+
+	while (1) {
+		long result;
+
+		if (size - used < DIRENTS_BUFFER_SIZE / 2) {
+			char *tmp;
+
+			size *= 2;
+			tmp = realloc(*buffer, size);
+			if (tmp == NULL)
+				return -ENOMEM;
+			*buffer = tmp;
+		}
+
+		result = syscall(SYS_getdents64, fd, *buffer + used, size - used);
+		if (result < 0)
+			return -errno;
+
+		if (result == 0)
+			return used;
+
+		used += result;
+	}
+}
+
+/**
+ * Check whether @entry is either "." or "..".
+ */
+static inline bool is_dot_entry(const struct linux_dirent64 *entry)
+{
+	return entry->d_name[0] == '.'
+		&& (entry->d_name[1] == '\0'
+			|| (entry->d_name[1] == '.' && entry->d_name[2] == '\0'));
+}
+
+/**
+ * Get the attributes in @mask of all the @size bytes of directory
+ * entries in @buffer, relatively to @fd, their directory.  This
+ * function returns an array allocated with malloc(3), indexed as the
+ * entries, where entries that couldn't be stat'ed have a null
+ * stx_mask; or NULL if there's not enough memory.
+ */
+static struct statx *stat_entries(int fd, const char *buffer, size_t size, unsigned int mask)
+{
+	struct linux_dirent64 *entry;
+	struct statx *attributes;
+	size_t nb_entries = 0;
+	size_t offset;
+	size_t i;
+
+	for (offset = 0; offset < size; offset += entry->d_reclen) {
+		entry = (struct linux_dirent64 *) (buffer + offset);
+		nb_entries++;
+	}
+
+	attributes = malloc(nb_entries * sizeof(struct statx));
+	if (attributes == NULL)
+		return NULL;
+
+	for (offset = 0, i = 0; offset < size; offset += entry->d_reclen, i++) {
+		entry = (struct linux_dirent64 *) (buffer + offset);
+
+		if (is_dot_entry(entry)
+		    || statx(fd, entry->d_name, AT_SYMLINK_NOFOLLOW, mask, &attributes[i]) < 0)
+			attributes[i].stx_mask = 0;
+	}
+
+	return attributes;
+}
+
+/**
+ * Read all the directory entries of @fd -- or of @path if @fd is
+ * negative -- into *@buffer, see read_dirents().  If @mask is not 0,
+ * the attributes of these entries are fetched too in *@attributes,
+ * see stat_entries().  @fd is closed.  The tree doesn't have to be
+ * locked.
+ */
+static ssize_t read_directory(int fd, const char *path, unsigned int mask,
+			char **buffer, struct statx **attributes)
+{
+	ssize_t size;
+
+	*buffer = NULL;
+	*attributes = NULL;
+
+	if (fd < 0) {
+		fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
+			return -errno;
+	}
+
+	size = read_dirents(fd, buffer);
+	if (size > 0 && mask != 0)
+		*attributes = stat_entries(fd, *buffer, size, mask);
+
+	(void) close(fd);
+
+	return size;
+}
+
+/**
+ * Add to @parent->children the entry @name of type @type and inode
+ * number @ino, carved from @pool, unless @parent has children
+ * already (@has_children) and this entry is one of them.  A negative
+ * child is turned into a regular one.  The attributes in @mask of
+ * this entry are cached from @attributes, if not NULL.  This
+ * function returns -errno if an error occurred, otherwise 0.
+ */
+static int splice_child(Node *parent, void *pool, bool has_children, const char *name, int type,
+			uint64_t ino, unsigned int mask, const struct statx *attributes)
+{
+	Node *child = NULL;
+
+	if (has_children)
+		child = find_in_index(parent, name, -1);
+
+	if (child != NULL) {
+		if (child->negative) {
+			child->negative = false;
+			child->type = type;
+		}
+	}
+	else {
+		child = add_new_child_from_pool(pool, parent, name, -1, type);
+		if (child == NULL)
+			return -ENOMEM;
+	}
+
+	if (ino != 0)
+		child->ino = ino;
+
+	if (attributes != NULL && attributes->stx_mask != 0)
+		set_attributes(child, mask, attributes);
+
+	return 0;
+}
+
+/**
+ * Fill @parent->children with the @size bytes of directory entries
+ * in @buffer, and their attributes in @mask from @attributes if not
+ * NULL, as read by read_directory().  All the new children are
+ * carved from one pool.  The tree has to be write-locked.  This
+ * function return -errno if an error occurred, otherwise 0.
+ */
+static int splice_children(Node *parent, const char *buffer, size_t size,
+			unsigned int mask, const struct statx *attributes)
+{
+	struct linux_dirent64 *entry;
+	size_t nb_entries;
+	bool has_children;
+	size_t pool_size;
+	size_t offset;
+	size_t i;
+	void *pool = NULL;
 	int status;
 
-	assert(!parent->children_filled);
-	assert(parent->type == DT_DIR);
+	assert(is_write_locked(parent->tree));
 
-	path = get_path(parent, ACTUAL_PATH);
-	if (path == NULL)
-		return -ENOMEM;
+	/* Compute how much memory is needed by the new children.  */
+	pool_size = 0;
+	nb_entries = 0;
+	for (offset = 0; offset < size; offset += entry->d_reclen) {
+		entry = (struct linux_dirent64 *) (buffer + offset);
+		if (is_dot_entry(entry))
+			continue;
 
-	dir = opendir(path);
-	if (dir == NULL)
-		return -errno;
+		pool_size += TALLOC_CHUNK_SIZE(sizeof(Node) + strlen(entry->d_name) + 1);
+		nb_entries++;
+	}
 
-	while (1) {
-		Node *child;
+	count_stat(parent->tree, STAT_FILLS, 1);
+	count_stat(parent->tree, STAT_ENTRIES, nb_entries);
 
-		errno = 0;
-		entry = readdir(dir);
-		if (entry == NULL) {
-			status = -errno;
+	if (pool_size > 0) {
+		pool = talloc_pool(parent, pool_size);
+		if (pool == NULL) {
+			status = -ENOMEM;
 			goto end;
 		}
+	}
 
-		if (   strcmp(entry->d_name, ".") == 0
-		    || strcmp(entry->d_name, "..") == 0)
-			continue;
+	/* Only special children can be there already, or children
+	 * that were not evicted, see evict_children().  */
+	has_children = (parent->children.nb_nodes != 0);
+
+	status = reserve_index(parent, nb_entries);
+	if (status < 0)
+		goto end;
 
-		HASH_FIND_STR(parent->children, entry->d_name, child);
-		if (child != NULL) {
-			if (!child->special)
-				fprintf(stderr, "Entry '%s' aldready filled in '%s'\n",
-					entry->d_name, get_path(parent, ACTUAL_PATH));
+	status = 0;
+	for (offset = 0, i = 0; offset < size; offset += entry->d_reclen, i++) {
+		entry = (struct linux_dirent64 *) (buffer + offset);
+		if (is_dot_entry(entry))
 			continue;
-		}
 
-		child = add_new_child(parent, entry->d_name, -1, entry->d_type);
-		if (child == NULL) {
+		status = splice_child(parent, pool, has_children, entry->d_name, entry->d_type,
+				entry->d_ino, mask, attributes != NULL ? &attributes[i] : NULL);
+		if (status < 0)
+			goto end;
+	}
+
+end:
+	parent->children_filled = true;
+
+	/* Memory carved from the pool is given back once all the
+	 * children are freed.  */
+	TALLOC_FREE(pool);
+
+	return status;
+}
+
+/**
+ * Fill @parent->children with the children of @record, its record in
+ * the snapshot of the tree, instead of reading the actual directory.
+ * The tree has to be write-locked.  This function return -errno if
+ * an error occurred, otherwise 0.
+ */
+static int splice_snapshot(Node *parent, const SnapshotRecord *record)
+{
+	const Snapshot *snapshot = parent->tree->snapshot;
+	bool has_children;
+	size_t pool_size;
+	void *pool = NULL;
+	int status;
+	uint32_t i;
+
+	assert(is_write_locked(parent->tree));
+
+	pool_size = 0;
+	for (i = 0; i < record->nb_children; i++) {
+		const SnapshotRecord *child = &snapshot->records[record->children + i];
+		const char *name = get_snapshot_string(snapshot, child->name);
+
+		pool_size += TALLOC_CHUNK_SIZE(sizeof(Node) + strlen(name) + 1);
+	}
+
+	if (pool_size > 0) {
+		pool = talloc_pool(parent, pool_size);
+		if (pool == NULL) {
 			status = -ENOMEM;
 			goto end;
 		}
 	}
 
+	has_children = (parent->children.nb_nodes != 0);
+
+	status = reserve_index(parent, record->nb_children);
+	if (status < 0)
+		goto end;
+
+	for (i = 0; i < record->nb_children; i++) {
+		const SnapshotRecord *child = &snapshot->records[record->children + i];
+		const char *name = get_snapshot_string(snapshot, child->name);
+
+		status = splice_child(parent, pool, has_children, name, child->type, 0, 0, NULL);
+		if (status < 0)
+			goto end;
+	}
+
 end:
 	parent->children_filled = true;
+	TALLOC_FREE(pool);
 
-	if (dir != NULL)
-		(void) closedir(dir);
+	watch_directory(parent);
 
 	return status;
 }
 
 /**
- * Delete recursively all @parent's children that are not "special"
- * and without external references.  If @show_size is true, @parent
- * tree size is printed on stderr.  This function returns number of
- * deleted nodes.
+ * Check whether the walk can't find @counterpart in the actual
+ * directory of its parent: it is either bound, evaluated, or has
+ * children of its own -- as the intermediate directories of a
+ * binding.
  */
-size_t flush_children(Node *parent, bool show_size)
+static inline bool is_virtual_child(const Node *counterpart)
 {
-	size_t nb_flushed_nodes = 0;
-	size_t total_size;
-	Node *child;
-	Node *tmp;
+	return counterpart->special
+		|| counterpart->attached_evaluator != NULL
+		|| counterpart->children.nb_nodes != 0;
+}
 
-	if (show_size)
-		total_size = talloc_total_size(parent);
+/**
+ * Fill @parent->children with the children of its counterpart in the
+ * tree it was cloned from, instead of reading the actual directory,
+ * if both have the same listing.  Otherwise only the children that
+ * can't be found in the actual directory are copied, see
+ * is_virtual_child().  The tree has to be write-locked.  This
+ * function return -errno if an error occurred, otherwise 0.
+ */
+static int splice_origin(Node *parent)
+{
+	const Node *counterpart;
+	const Node *child;
+	bool has_children;
+	size_t nb_entries;
+	size_t pool_size;
+	void *pool = NULL;
+	int status = 0;
+	bool whole;
+
+	assert(is_write_locked(parent->tree));
+
+	counterpart = lock_origin_node(parent);
+	if (counterpart == NULL)
+		return 0;
+
+	whole = !parent->children_filled && has_same_listing(parent, counterpart);
+
+	pool_size = 0;
+	nb_entries = 0;
+	FOR_EACH_CHILD(child, counterpart) {
+		if (child->negative || (!whole && !is_virtual_child(child)))
+			continue;
+
+		pool_size += TALLOC_CHUNK_SIZE(sizeof(Node) + strlen(child->name) + 1);
+		nb_entries++;
+	}
+
+	if (pool_size > 0) {
+		pool = talloc_pool(parent, pool_size);
+		if (pool == NULL) {
+			status = -ENOMEM;
+			goto end;
+		}
+	}
 
-	HASH_ITER(hh, parent->children, child, tmp) {
-		size_t reference_count;
+	has_children = (parent->children.nb_nodes != 0);
 
-		nb_flushed_nodes += flush_children(child, false);
+	status = reserve_index(parent, nb_entries);
+	if (status < 0)
+		goto end;
 
-		reference_count = talloc_reference_count(child);
-		if (reference_count > 1 || child->special)
+	FOR_EACH_CHILD(child, counterpart) {
+		if (child->negative || (!whole && !is_virtual_child(child)))
 			continue;
 
-		HASH_DEL(parent->children, child);
-		TALLOC_FREE(child);
+		status = splice_child(parent, pool, has_children, child->name, child->type,
+				child->ino, 0, NULL);
+		if (status < 0)
+			goto end;
+	}
+
+end:
+	unlock_origin(parent->tree);
+
+	if (whole) {
+		parent->children_filled = true;
+		watch_directory(parent);
+	}
+
+	TALLOC_FREE(pool);
+
+	return status;
+}
+
+/**
+ * Add to @parent->children the entry @name, of @length bytes, if its
+ * counterpart in the tree it was cloned from exists, see
+ * lookup_child().  Only virtual children are copied, unless both
+ * parents have the same listing, see has_same_listing(); in this
+ * case *@listed is set to true, and a missing counterpart means this
+ * entry doesn't exist either.  The tree has to be write-locked.  This
+ * function returns NULL if an error occurred or if there's no such
+ * counterpart, otherwise the new child.
+ */
+static Node *lookup_origin_child(Node *parent, const char *name, size_t length, bool *listed)
+{
+	const Node *counterpart;
+	const Node *origin;
+	Node *child = NULL;
+
+	*listed = false;
+
+	origin = lock_origin_node(parent);
+	if (origin == NULL)
+		return NULL;
+
+	*listed = has_same_listing(parent, origin);
+
+	counterpart = find_in_index(origin, name, length);
+	if (   counterpart != NULL
+	    && !counterpart->negative
+	    && (*listed || is_virtual_child(counterpart))) {
+		child = add_new_child(parent, name, length, counterpart->type);
+		if (child != NULL)
+			child->ino = counterpart->ino;
+	}
+
+	unlock_origin(parent->tree);
+
+	return child;
+}
+
+/**
+ * Get the record of @parent in the snapshot of its tree, if its
+ * listing is there.  The tree has to be locked, at least for
+ * reading.
+ */
+static const SnapshotRecord *find_filled_record(const Node *parent)
+{
+	const SnapshotRecord *record = find_snapshot_record(parent);
+
+	return record != NULL && record->filled ? record : NULL;
+}
+
+/**
+ * Prepare in @fill the filling of @parent->children without holding
+ * the tree lock.  If @parent is being filled by another thread
+ * already, finish_fill() will wait for this latter instead.  The tree
+ * has to be locked, at least for reading.  This function returns
+ * -errno if an error occurred, otherwise 0.
+ */
+int start_fill(Fill *fill, Node *parent)
+{
+	Tree *tree = parent->tree;
+	ssize_t status;
+	size_t i;
+
+	fill->tree       = tree;
+	fill->parent     = parent;
+	fill->generation = get_generation(tree);
+	fill->owner      = false;
+	fill->record     = find_filled_record(parent);
+	fill->from_origin = (fill->record == NULL && has_origin(tree)
+			&& has_origin_listing(parent));
+
+	fill->fd         = -1;
+
+	/* Nothing has to be read from the file-system.  */
+	if (fill->record != NULL || fill->from_origin) {
+		fill->owner = true;
+		return 0;
+	}
+
+	/* The path is still needed to watch this directory.  */
+	status = render_path(parent, ACTUAL_PATH, fill->path, sizeof(fill->path));
+	if (status < 0) {
+		if (!uses_descriptors(tree))
+			return -ENAMETOOLONG;
+		fill->path[0] = '\0';
+	}
+
+	pthread_mutex_lock(&tree->fills.lock);
+
+	for (i = 0; i < tree->fills.nb_nodes; i++) {
+		if (tree->fills.nodes[i] == parent)
+			break;
+	}
+
+	if (i == tree->fills.nb_nodes) {
+		const Node **nodes;
+
+		nodes = realloc(tree->fills.nodes, (i + 1) * sizeof(Node *));
+		if (nodes == NULL) {
+			pthread_mutex_unlock(&tree->fills.lock);
+			return -ENOMEM;
+		}
+
+		nodes[i] = parent;
+		tree->fills.nodes = nodes;
+		tree->fills.nb_nodes++;
+
+		fill->owner = true;
+	}
+
+	pthread_mutex_unlock(&tree->fills.lock);
+
+	/* Only the last component of the path is walked by the
+	 * kernel, the directory is read later without the lock.  */
+	if (fill->owner && uses_descriptors(tree))
+		fill->fd = open_directory(parent);
+
+	return 0;
+}
+
+/**
+ * Fill @fill->parent->children as prepared by start_fill(), or wait
+ * for the thread that does it.  The directory is read without
+ * holding the tree lock, then its entries are added only if no
+ * nodes were flushed in the meantime.  The tree must not be locked
+ * by the current thread.  This function returns -errno if an error
+ * occurred, otherwise 0.
+ */
+int finish_fill(Fill *fill)
+{
+	struct statx *attributes;
+	Tree *tree = fill->tree;
+	unsigned int mask;
+	uint64_t start;
+	bool watching;
+	bool current;
+	char *buffer;
+	ssize_t size;
+	int status = 0;
+	size_t i;
+	int wd = -1;
+
+	/* The generation ensures the snapshot is still there.  The
+	 * listing of the original tree is checked again since it
+	 * might have changed meanwhile, in which case @fill->parent
+	 * is filled from the file-system on the next attempt.  */
+	if (fill->record != NULL || fill->from_origin) {
+		write_lock_tree(tree);
+		current = (get_generation(tree) == fill->generation);
+		if (current)
+			(void) revalidate_node(fill->parent);
+		if (current && !fill->parent->children_filled)
+			status = fill->record != NULL
+				? splice_snapshot(fill->parent, fill->record)
+				: splice_origin(fill->parent);
+		write_unlock_tree(tree);
+
+		return status;
+	}
+
+	if (!fill->owner) {
+		pthread_mutex_lock(&tree->fills.lock);
+		while (1) {
+			for (i = 0; i < tree->fills.nb_nodes; i++) {
+				if (tree->fills.nodes[i] == fill->parent)
+					break;
+			}
+
+			if (i == tree->fills.nb_nodes)
+				break;
+
+			pthread_cond_wait(&tree->fills.done, &tree->fills.lock);
+		}
+		pthread_mutex_unlock(&tree->fills.lock);
+
+		return 0;
+	}
+
+	start = start_latency();
+
+	/* The directory is watched before being read, so as no
+	 * changes are missed.  */
+	watching = begin_watch(tree);
+	if (watching)
+		wd = add_watch(tree, fill->path);
+
+	/* The batch of attributes is fetched without the lock too.  */
+	mask = get_batch_attributes(tree);
+
+	if (fill->fd >= 0 || fill->path[0] != '\0')
+		size = read_directory(fill->fd, fill->path, mask, &buffer, &attributes);
+	else {
+		buffer = NULL;
+		attributes = NULL;
+		size = -ENAMETOOLONG;
+	}
+
+	/* @fill->parent might have been freed if the generation has
+	 * changed.  Otherwise its actual path is the one read, but
+	 * previous children might come from an older binding.  */
+	write_lock_tree(tree);
+	current = (get_generation(tree) == fill->generation);
+	if (current)
+		(void) revalidate_node(fill->parent);
+	if (current && !fill->parent->children_filled) {
+		if (size < 0)
+			status = size;
+		else
+			status = splice_children(fill->parent, buffer, size, mask, attributes);
+		if (status >= 0 && has_origin(tree))
+			status = splice_origin(fill->parent);
+		register_watch(fill->parent, wd);
+
+		/* It tells whether these children are still valid
+		 * once a binding is changed.  */
+		if (status >= 0)
+			(void) get_path(fill->parent, ACTUAL_PATH);
+	}
+	else
+		release_watch(tree, wd);
+	write_unlock_tree(tree);
+
+	record_latency(tree, LATENCY_FILL, start);
+
+	if (watching)
+		end_watch(tree);
+
+	free(attributes);
+	free(buffer);
+
+	pthread_mutex_lock(&tree->fills.lock);
+	for (i = 0; i < tree->fills.nb_nodes; i++) {
+		if (tree->fills.nodes[i] == fill->parent) {
+			tree->fills.nodes[i] = tree->fills.nodes[--tree->fills.nb_nodes];
+			break;
+		}
+	}
+	pthread_cond_broadcast(&tree->fills.done);
+	pthread_mutex_unlock(&tree->fills.lock);
+
+	return status;
+}
+
+/**
+ * Fill @parent->children with the directory entries of @parent actual
+ * path, or with the children of its record in the snapshot of the
+ * tree if this latter is loaded, or with the children of its
+ * counterpart in the tree it was cloned from.  All the entries are read in one
+ * batch with getdents64(2), without holding the tree lock unless the
+ * current thread holds it already.  This function return -errno if an error occurred,
+ * otherwise 0.
+ */
+int fill_children(Node *parent)
+{
+	const SnapshotRecord *record;
+	struct statx *attributes;
+	Tree *tree = parent->tree;
+	unsigned int mask;
+	const char *path;
+	uint64_t start;
+	char *buffer;
+	ssize_t size;
+	int wd = -1;
+	Fill fill;
+	int status;
+	int fd;
+
+	assert(parent->type == DT_DIR);
+
+	if (!is_write_locked(tree)) {
+		bool filled;
+
+		read_lock_tree(tree);
+		filled = parent->children_filled && !is_binding_stale(parent);
+		status = filled ? 0 : start_fill(&fill, parent);
+		read_unlock_tree(tree);
+
+		if (status < 0 || filled)
+			return status;
+
+		return finish_fill(&fill);
+	}
+
+	(void) revalidate_node(parent);
+
+	if (parent->children_filled)
+		return 0;
+
+	record = find_filled_record(parent);
+	if (record != NULL)
+		return splice_snapshot(parent, record);
+
+	if (has_origin(tree)) {
+		status = splice_origin(parent);
+		if (status < 0 || parent->children_filled)
+			return status;
+	}
+
+	path = get_path(parent, ACTUAL_PATH);
+	if (path == NULL)
+		return -ENOMEM;
+
+	start = start_latency();
+
+	if (is_watching(tree))
+		wd = add_watch(tree, path);
+
+	mask = get_batch_attributes(tree);
+
+	fd = uses_descriptors(tree) ? open_directory(parent) : -1;
+	size = read_directory(fd, path, mask, &buffer, &attributes);
+	if (size < 0)
+		status = size;
+	else
+		status = splice_children(parent, buffer, size, mask, attributes);
+
+	register_watch(parent, wd);
+
+	record_latency(tree, LATENCY_FILL, start);
+
+	free(attributes);
+	free(buffer);
+
+	return status;
+}
+
+/**
+ * Add to @parent->children the entry @name, of @length bytes, without
+ * filling the whole directory: only this entry is checked in
+ * @parent's actual path, or in the tree @parent's tree was cloned
+ * from.  If this entry doesn't exist, a "negative" child is added so
+ * as the next lookup doesn't have to check it again.  Directories of
+ * a tree that doesn't do lazy lookups are filled instead, unless the
+ * entry is found in the original tree.  The tree has to be
+ * write-locked.  This function returns NULL if an error occurred or
+ * if this entry doesn't exist, otherwise the new child.
+ */
+Node *lookup_child(Node *parent, const char *name, size_t length)
+{
+	char path[PATH_MAX];
+	struct statx attributes;
+	unsigned int mask;
+	bool listed;
+	ssize_t size;
+	Node *child;
+	int status;
 
-		nb_flushed_nodes++;
+	assert(is_write_locked(parent->tree));
+	assert(!parent->children_filled);
+	assert(parent->type == DT_DIR);
+
+	/* Filling the whole directory from the snapshot is cheaper
+	 * than checking this entry in the file-system.  */
+	if (find_filled_record(parent) != NULL) {
+		(void) fill_children(parent);
+		child = find_in_index(parent, name, length);
+		return child != NULL && !child->negative ? child : NULL;
 	}
 
+	/* Nodes of a clone are copied from the original tree one at
+	 * a time, so as its memory grows with the entries it looks
+	 * up, not with the listings of their parents.  */
+	if (has_origin(parent->tree)) {
+		child = lookup_origin_child(parent, name, length, &listed);
+		if (child != NULL || listed) {
+			watch_directory(parent);
+
+			/* As in finish_fill().  */
+			(void) get_path(parent, ACTUAL_PATH);
+		}
+
+		if (child != NULL)
+			return child;
+
+		if (listed) {
+			child = add_new_child(parent, name, length, DT_UNKNOWN);
+			if (child != NULL)
+				child->negative = true;
+			return NULL;
+		}
+	}
+
+	if (!parent->tree->lazy_lookup) {
+		(void) fill_children(parent);
+		child = find_in_index(parent, name, length);
+		return child != NULL && !child->negative ? child : NULL;
+	}
+
+	/* Changes of this entry are reported from now on.  */
+	watch_directory(parent);
+
+	/* This entry is stat'ed anyway.  */
+	mask = STATX_TYPE | get_batch_attributes(parent->tree);
+
+	if (uses_descriptors(parent->tree)) {
+		/* Only this entry is walked by the kernel.  */
+		if (length >= sizeof(path))
+			return NULL;
+
+		memcpy(path, name, length);
+		path[length] = '\0';
+
+		status = stat_child(parent, path, mask, &attributes);
+	}
+	else {
+		size = render_path(parent, ACTUAL_PATH, path, sizeof(path));
+		if (size < 0)
+			return NULL;
+
+		if (size > 0 && path[size - 1] != '/')
+			path[size++] = '/';
+
+		if (size + length >= sizeof(path))
+			return NULL;
+
+		memcpy(path + size, name, length);
+		path[size + length] = '\0';
+
+		status = statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, mask, &attributes);
+		if (status < 0)
+			status = -errno;
+	}
+
+	if (status < 0 && status != -ENOENT)
+		return NULL;
+
+	/* As in finish_fill().  */
+	(void) get_path(parent, ACTUAL_PATH);
+
+	child = add_new_child(parent, name, length, status < 0 ? DT_UNKNOWN : IFTODT(attributes.stx_mode));
+	if (child == NULL)
+		return NULL;
+
+	if (status < 0) {
+		child->negative = true;
+		return NULL;
+	}
+
+	if ((attributes.stx_mask & STATX_INO) != 0)
+		child->ino = attributes.stx_ino;
+
+	if (mask != STATX_TYPE)
+		set_attributes(child, mask, &attributes);
+
+	return child;
+}
+
+/**
+ * Forget that @node's children were filled, see flush_children().
+ */
+static int unfill_node(Node *node, size_t depth, void *data)
+{
+	(void) depth;
+	(void) data;
+
+	node->children_filled = false;
+
+	return 0;
+}
+
+/**
+ * Same as unfill_node(), except descendants of special nodes are
+ * skipped, see flush_unbound_children().
+ */
+static int unfill_unbound_node(Node *node, size_t depth, void *data)
+{
+	if (depth > 0 && node->special)
+		return VISIT_PRUNE;
+
+	return unfill_node(node, depth, data);
+}
+
+/**
+ * Delete @node if it is neither the root of the flush, "special",
+ * referenced elsewhere, nor with children, see flush_children().
+ * @data points to the number of deleted nodes.
+ */
+static int flush_node(Node *node, size_t depth, void *data)
+{
+	size_t *nb_flushed_nodes = data;
+	size_t reference_count;
+
+	if (depth == 0)
+		return 0;
+
+	/* The actual file might have been replaced.  */
+	drop_descriptor(node);
+	flush_attributes(node);
+
+	reference_count = talloc_reference_count(node);
+	if (reference_count > 1 || node->special || node->children.nb_nodes != 0)
+		return 0;
+
+	delete_node(node);
+
+	(*nb_flushed_nodes)++;
+
+	return 0;
+}
+
+/**
+ * Flush @parent's children as flush_children() does, where @pre
+ * tells which nodes are visited.
+ */
+static size_t flush_children_(Node *parent, Visitor pre, bool show_size)
+{
+	size_t nb_flushed_nodes = 0;
+	size_t total_size;
+
+	write_lock_tree(parent->tree);
+
+	if (show_size)
+		total_size = talloc_total_size(parent);
+
+	bump_generation(parent);
+	count_stat(parent->tree, STAT_FLUSHES, 1);
+
+	(void) visit_tree(parent, pre, flush_node, &nb_flushed_nodes);
+
 	if (show_size) {
 		fprintf(stderr, "number of flushed nodes: %zd\n", nb_flushed_nodes);
 		fprintf(stderr, "size before flush: %zd\n", total_size);
 		fprintf(stderr, "size after flush:  %zd\n", talloc_total_size(parent));
 	}
 
-	parent->children_filled = false;
+	write_unlock_tree(parent->tree);
 
 	return nb_flushed_nodes;
 }
+
+/**
+ * Delete recursively all @parent's children that are not "special"
+ * and without external references.  Children that still have
+ * children afterward are kept, so as these latter are not freed
+ * along with them.  If @show_size is true, @parent tree size is
+ * printed on stderr.  This function returns number of deleted nodes.
+ */
+size_t flush_children(Node *parent, bool show_size)
+{
+	return flush_children_(parent, unfill_node, show_size);
+}
+
+/**
+ * Same as flush_children(), except the subtrees of "special"
+ * descendants are kept too, since their actual paths don't depend
+ * on @parent's one, see revalidate_node().
+ */
+size_t flush_unbound_children(Node *parent)
+{
+	return flush_children_(parent, unfill_unbound_node, false);
+}
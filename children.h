@@ -23,9 +23,51 @@
 #ifndef PROOT_VFS_CHILDREN
 #define PROOT_VFS_CHILDREN
 
+#include <limits.h>	/* PATH_MAX, */
+#include <stdint.h>	/* *int*_t, */
 #include "vfs/node.h"
+#include "vfs/snapshot.h"
+
+/* Layout of the records returned by getdents64(2), and by
+ * read_children().  */
+struct linux_dirent64
+{
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+
+/* Filling of a directory without holding the tree lock, see
+ * start_fill() and finish_fill().  */
+typedef struct {
+	struct tree *tree;
+	Node *parent;
+	size_t generation;
+	bool owner;
+
+	/* Record of @parent in the snapshot, if its listing is there,
+	 * see load_snapshot().  */
+	const SnapshotRecord *record;
+
+	/* Whether the listing of @parent is copied from the tree it
+	 * was cloned from, see clone_tree().  */
+	bool from_origin;
+
+	/* Directory opened relatively to the descriptor of its parent,
+	 * or -1 if @path has to be opened instead, see
+	 * open_directory().  */
+	int fd;
+
+	char path[PATH_MAX];
+} Fill;
 
 extern int fill_children(Node *parent);
+extern int start_fill(Fill *fill, Node *parent);
+extern int finish_fill(Fill *fill);
+extern Node *lookup_child(Node *parent, const char *name, size_t length);
 extern size_t flush_children(Node *parent, bool show_size);
+extern size_t flush_unbound_children(Node *parent);
 
 #endif /* PROOT_VFS_CHILDREN */
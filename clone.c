@@ -0,0 +1,319 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdlib.h>	/* malloc(3), free(3), */
+#include <string.h>	/* strcmp(3), */
+#include <limits.h>	/* PATH_MAX, */
+#include <assert.h>	/* assert(3), */
+#include <dirent.h>	/* DT_DIR, */
+#include <pthread.h>	/* pthread_rwlock_*, */
+#include <talloc.h>
+#include "vfs/clone.h"
+#include "vfs/node.h"
+#include "vfs/tree.h"
+#include "vfs/path.h"
+#include "vfs/memory.h"
+#include "vfs/watch.h"
+#include "vfs/descriptor.h"
+#include "vfs/attributes.h"
+#include "vfs/component.h"
+#include "vfs/evaluator.h"
+#include "vfs/binding.h"
+
+/**
+ * Allocate the link given to the clones of @root's tree.  This
+ * function returns NULL if there's not enough memory.
+ */
+static Origin *new_origin(Node *root)
+{
+	Origin *origin;
+
+	origin = malloc(sizeof(Origin));
+	if (origin == NULL)
+		return NULL;
+
+	if (pthread_rwlock_init(&origin->lock, NULL) != 0) {
+		free(origin);
+		return NULL;
+	}
+
+	origin->root = root;
+
+	/* This reference is dropped when the tree is deleted.  */
+	origin->nb_references = 1;
+
+	return origin;
+}
+
+/**
+ * Drop a reference to @origin, then free it if it was the last one.
+ */
+static void unref_origin(Origin *origin)
+{
+	if (origin == NULL)
+		return;
+
+	if (__atomic_sub_fetch(&origin->nb_references, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+
+	(void) pthread_rwlock_destroy(&origin->lock);
+	free(origin);
+}
+
+/**
+ * Create a logical copy of the tree of @root, without copying any
+ * node: the nodes of the clone are created on first access only,
+ * from the original tree whenever this latter has their parent
+ * filled already.  Lookups copy only the nodes they walk, see
+ * lookup_child(), whole listings are copied only when the children
+ * of a directory are filled, see splice_origin().  Both trees are
+ * independent from then on, for instance set_actual_path() on one of
+ * them doesn't change the other.  This function returns NULL if
+ * there's not enough memory, otherwise the root of the clone.
+ *
+ * Bindings -- special nodes -- and evaluators are copied right away.
+ * Nothing is copied from the original tree anymore once a binding is
+ * changed or a node is created there, see lock_origin_node().
+ */
+Node *clone_tree(Node *root)
+{
+	Tree *tree = root->tree;
+	unsigned int batch_attributes;
+	size_t max_descriptors;
+	bool lazy_lookup;
+	Origin *origin;
+	size_t budget;
+	bool watching;
+	Node *clone;
+
+	assert(root->parent == root);
+
+	clone = new_node(NULL, root->name, -1, root->type);
+	if (clone == NULL)
+		return NULL;
+
+	write_lock_tree(tree);
+
+	origin = tree->origin.link;
+	if (origin == NULL) {
+		origin = new_origin(root);
+		if (origin == NULL) {
+			write_unlock_tree(tree);
+			goto error;
+		}
+		tree->origin.link = origin;
+	}
+
+	__atomic_add_fetch(&origin->nb_references, 1, __ATOMIC_RELAXED);
+	clone->tree->origin.from = origin;
+
+	/* Bindings are copied afterward, any change in the meantime
+	 * only prevents the clone from copying nodes.  */
+	clone->tree->origin.binding_epoch = tree->binding_epoch;
+	clone->tree->origin.creations     = tree->creations;
+
+	lazy_lookup      = tree->lazy_lookup;
+	batch_attributes = tree->batch_attributes;
+	budget           = tree->memory.budget;
+	max_descriptors  = tree->descriptors.max;
+	watching         = is_watching(tree);
+
+	write_unlock_tree(tree);
+
+	/* Settings are copied without holding the lock of the
+	 * original tree, since they lock the clone.  */
+	if (copy_bindings(clone, root) < 0)
+		goto error;
+
+	if (copy_evaluators(clone, root) < 0)
+		goto error;
+
+	set_lazy_lookup(clone, lazy_lookup);
+	set_batch_attributes(clone, batch_attributes);
+	(void) set_memory_budget(clone, budget);
+
+	if (max_descriptors > 0)
+		(void) set_directory_descriptors(clone, max_descriptors);
+
+	if (watching)
+		(void) set_watch_mode(clone, true);
+
+	return clone;
+
+error:
+	(void) delete_tree(clone);
+	return NULL;
+}
+
+/**
+ * Get the counterpart of @node in the tree its tree was cloned from,
+ * that is, the node with the same virtual path.  This latter tree is
+ * left read-locked if the counterpart is found, until unlock_origin()
+ * is called.  The tree of @node has to be locked, at least for
+ * reading.  This function returns NULL if there's no counterpart,
+ * otherwise the counterpart.
+ */
+const Node *lock_origin_node(const Node *node)
+{
+	Origin *origin = node->tree->origin.from;
+	const Node *counterpart;
+	char path[PATH_MAX];
+	Component component;
+	const char *cursor;
+
+	if (origin == NULL)
+		return NULL;
+
+	/* The virtual path of @node is made of the names of its
+	 * ancestors, as it is in the original tree.  */
+	if (render_path(node, VIRTUAL_PATH, path, sizeof(path)) < 0)
+		return NULL;
+
+	(void) pthread_rwlock_rdlock(&origin->lock);
+
+	if (origin->root == NULL) {
+		(void) pthread_rwlock_unlock(&origin->lock);
+		return NULL;
+	}
+
+	/* Clones are locked before their origin, never the opposite,
+	 * see detach_clones().  */
+	read_lock_tree(origin->root->tree);
+
+	/* Bindings changed and nodes created in the original tree
+	 * since the clone was made don't apply to this latter.  */
+	if (   origin->root->tree->binding_epoch != node->tree->origin.binding_epoch
+	    || origin->root->tree->creations != node->tree->origin.creations) {
+		unlock_origin(node->tree);
+		return NULL;
+	}
+
+	counterpart = origin->root;
+	for (cursor = path; cursor[0] != '\0' && counterpart != NULL; ) {
+		cursor = next_component(cursor, &component);
+		if (component.length == 0)
+			continue;
+
+		counterpart = find_hashed_in_index(counterpart, component.name,
+						component.length, component.hash);
+		if (counterpart != NULL && counterpart->negative)
+			counterpart = NULL;
+	}
+
+	if (counterpart == NULL)
+		unlock_origin(node->tree);
+
+	return counterpart;
+}
+
+/**
+ * Unlock the tree @tree was cloned from, as left locked by
+ * lock_origin_node().
+ */
+void unlock_origin(const Tree *tree)
+{
+	Origin *origin = tree->origin.from;
+
+	read_unlock_tree(origin->root->tree);
+	(void) pthread_rwlock_unlock(&origin->lock);
+}
+
+/**
+ * Check whether @node, a directory, can get all its children from
+ * @counterpart, as returned by lock_origin_node(): this latter has
+ * to be filled and with the same actual path.  Both trees have to be
+ * locked, at least for reading.
+ */
+bool has_same_listing(const Node *node, const Node *counterpart)
+{
+	char counterpart_path[PATH_MAX];
+	char path[PATH_MAX];
+
+	/* The listing of @counterpart might come from a previous
+	 * binding of the original tree.  */
+	if (!counterpart->children_filled || counterpart->type != DT_DIR
+	    || is_binding_stale(counterpart))
+		return false;
+
+	if (render_path(node, ACTUAL_PATH, path, sizeof(path)) < 0)
+		return false;
+
+	if (render_path(counterpart, ACTUAL_PATH, counterpart_path, sizeof(counterpart_path)) < 0)
+		return false;
+
+	return strcmp(path, counterpart_path) == 0;
+}
+
+/**
+ * Check whether @node, a directory, can get all its children from
+ * the tree its tree was cloned from, see has_same_listing().  The
+ * tree has to be locked, at least for reading.
+ */
+bool has_origin_listing(const Node *node)
+{
+	const Node *counterpart;
+	bool result;
+
+	counterpart = lock_origin_node(node);
+	if (counterpart == NULL)
+		return false;
+
+	result = has_same_listing(node, counterpart);
+
+	unlock_origin(node->tree);
+
+	return result;
+}
+
+/**
+ * Stop the clones of @tree from copying anything from it, since it
+ * is being deleted.  The tree must not be locked by the current
+ * thread.
+ */
+void detach_clones(Tree *tree)
+{
+	Origin *origin = tree->origin.link;
+
+	if (origin == NULL)
+		return;
+
+	/* Clones lock this latter before @tree, hence they are done
+	 * with it once the link is write-locked.  */
+	(void) pthread_rwlock_wrlock(&origin->lock);
+	origin->root = NULL;
+	(void) pthread_rwlock_unlock(&origin->lock);
+}
+
+/**
+ * Release the links of @tree to the tree it was cloned from and to
+ * its own clones, see tree_destructor().
+ */
+void release_origin(Tree *tree)
+{
+	detach_clones(tree);
+
+	unref_origin(tree->origin.link);
+	unref_origin(tree->origin.from);
+
+	tree->origin.link = NULL;
+	tree->origin.from = NULL;
+}
@@ -0,0 +1,58 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_CLONE
+#define PROOT_VFS_CLONE
+
+#include <stdbool.h>	/* bool, */
+#include <pthread.h>	/* pthread_rwlock_t, */
+#include "vfs/node.h"
+#include "vfs/tree.h"
+
+/* Weak link from the clones of a tree to this latter, see
+ * clone_tree().  It is shared by the tree and its clones, and
+ * outlives the tree: @root is reset to NULL once this latter is
+ * deleted, then clones don't copy anything from it anymore.  */
+typedef struct origin {
+	pthread_rwlock_t lock;
+	Node *root;
+	size_t nb_references;
+} Origin;
+
+extern Node *clone_tree(Node *root);
+extern const Node *lock_origin_node(const Node *node);
+extern void unlock_origin(const Tree *tree);
+extern bool has_same_listing(const Node *node, const Node *counterpart);
+extern bool has_origin_listing(const Node *node);
+extern void detach_clones(Tree *tree);
+extern void release_origin(Tree *tree);
+
+/**
+ * Check whether @tree was cloned from another tree, and this latter
+ * might still be there.  The tree doesn't have to be locked.
+ */
+static inline bool has_origin(const Tree *tree)
+{
+	return tree->origin.from != NULL;
+}
+
+#endif /* PROOT_VFS_CLONE */
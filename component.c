@@ -0,0 +1,121 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+
+#include <stdint.h>	/* uint*_t, uintptr_t, */
+#include <string.h>	/* strcspn(3), */
+#if defined(__AVX2__)
+#include <immintrin.h>	/* _mm256_*, */
+#elif defined(__SSE2__)
+#include <emmintrin.h>	/* _mm_*, */
+#endif
+#include "vfs/component.h"
+
+/* Chunks are aligned, so they never cross a page boundary, however
+ * they may be read past the end of the path -- as strlen(3) does --
+ * hence they are hidden from AddressSanitizer.  */
+#if defined(__SANITIZE_ADDRESS__)
+#define NO_SANITIZE __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE
+#endif
+
+#if defined(__AVX2__)
+#define CHUNK_SIZE 32
+typedef __m256i Chunk;
+
+/**
+ * Get the mask of the bytes of @chunk that are either '/' or '\0'.
+ */
+static inline NO_SANITIZE uint32_t match_separators(const Chunk *chunk)
+{
+	__m256i bytes = _mm256_load_si256(chunk);
+
+	return _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('/')),
+						_mm256_cmpeq_epi8(bytes, _mm256_setzero_si256())));
+}
+#elif defined(__SSE2__)
+#define CHUNK_SIZE 16
+typedef __m128i Chunk;
+
+/**
+ * Get the mask of the bytes of @chunk that are either '/' or '\0'.
+ */
+static inline NO_SANITIZE uint32_t match_separators(const Chunk *chunk)
+{
+	__m128i bytes = _mm_load_si128(chunk);
+
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('/')),
+					_mm_cmpeq_epi8(bytes, _mm_setzero_si128())));
+}
+#endif
+
+/**
+ * Get the number of bytes of @name that are neither '/' nor '\0'.
+ */
+static NO_SANITIZE size_t get_component_length(const char *name)
+{
+#if defined(CHUNK_SIZE)
+	uintptr_t offset = (uintptr_t) name % CHUNK_SIZE;
+	const Chunk *chunk = (const Chunk *) (name - offset);
+	uint32_t mask;
+	size_t length;
+
+	/* Bytes before @name don't count.  */
+	mask = match_separators(chunk) & (~0U << offset);
+	if (mask != 0)
+		return __builtin_ctz(mask) - offset;
+
+	for (length = CHUNK_SIZE - offset; ; length += CHUNK_SIZE) {
+		mask = match_separators(++chunk);
+		if (mask != 0)
+			return length + __builtin_ctz(mask);
+	}
+#else
+	return strcspn(name, "/");
+#endif
+}
+
+/**
+ * Split in @component the first component of @path, after its
+ * leading slashes, if any: its name, length, hash and whether it is
+ * "." or "..".  This function returns the end of this component in
+ * @path, that is, either a slash or the terminating null byte.
+ */
+const char *next_component(const char *path, Component *component)
+{
+	while (path[0] == '/')
+		path++;
+
+	component->name   = path;
+	component->length = get_component_length(path);
+
+	if (path[0] == '.' && component->length <= 2
+	    && (component->length == 1 || path[1] == '.'))
+		component->kind = (component->length == 1 ? COMPONENT_DOT : COMPONENT_DOTDOT);
+	else
+		component->kind = COMPONENT_NAME;
+
+	component->hash = hash_name(path, component->length);
+
+	return path + component->length;
+}
@@ -0,0 +1,90 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_COMPONENT
+#define PROOT_VFS_COMPONENT
+
+#include <stddef.h>	/* size_t, */
+#include <stdint.h>	/* uint*_t, */
+#include <string.h>	/* memcpy(3), */
+
+/* Kind of a path component, see next_component().  */
+typedef enum {
+	COMPONENT_NAME,
+	COMPONENT_DOT,
+	COMPONENT_DOTDOT,
+} ComponentKind;
+
+/* Component of a path, as split by next_component().  */
+typedef struct {
+	const char *name;
+	size_t length;
+	uint32_t hash;
+	ComponentKind kind;
+} Component;
+
+extern const char *next_component(const char *path, Component *component);
+
+/**
+ * Mix @word into @hash, see hash_name().
+ */
+static inline uint64_t mix_word(uint64_t hash, uint64_t word)
+{
+	hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+	return hash ^ (hash >> 32);
+}
+
+/**
+ * Compute the hash of @name, of @length bytes.  Names are hashed
+ * eight bytes at a time, this is the hash of the child index.
+ */
+static inline uint32_t hash_name(const char *name, size_t length)
+{
+	uint64_t hash = 0x9e3779b97f4a7c15ULL ^ length;
+	uint64_t word;
+
+	for (; length >= sizeof(word); name += sizeof(word), length -= sizeof(word)) {
+		memcpy(&word, name, sizeof(word));
+		hash = mix_word(hash, word);
+	}
+
+	/* The last bytes are read at once, possibly twice.  */
+	if (length >= 4) {
+		uint32_t low;
+		uint32_t high;
+
+		memcpy(&low, name, sizeof(low));
+		memcpy(&high, name + length - sizeof(high), sizeof(high));
+		hash = mix_word(hash, (uint64_t) high << 32 | low);
+	}
+	else if (length > 0) {
+		word = (unsigned char) name[0]
+			| (unsigned char) name[length / 2] << 8
+			| (unsigned char) name[length - 1] << 16;
+		hash = mix_word(hash, word);
+	}
+
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	return hash ^ (hash >> 33);
+}
+
+#endif /* PROOT_VFS_COMPONENT */
@@ -0,0 +1,399 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+
+#include <sys/resource.h>	/* getrlimit(2), */
+#include <sys/stat.h>	/* statx(2), */
+#include <sys/param.h>	/* MIN, */
+#include <limits.h>	/* PATH_MAX, */
+#include <dirent.h>	/* DT_DIR, */
+#include <unistd.h>	/* close(2), readlinkat(2), */
+#include <fcntl.h>	/* openat(2), O_*, */
+#include <errno.h>	/* E*, errno(3), */
+#include <assert.h>	/* assert(3), */
+#include <pthread.h>	/* pthread_*, */
+#include <talloc.h>
+#include "vfs/descriptor.h"
+#include "vfs/node.h"
+#include "vfs/path.h"
+#include "vfs/tree.h"
+
+/* Fraction of RLIMIT_NOFILE that can be used by the pool of a tree,
+ * the remaining descriptors are left to the rest of the process.  */
+#define RLIMIT_FRACTION 4
+
+struct descriptor
+{
+	/* Directory opened with O_PATH, or NULL if this slot is
+	 * free.  */
+	Node *node;
+	int fd;
+
+	/* Number of threads that use @fd, it can't be closed in the
+	 * meantime.  */
+	unsigned int users;
+
+	/* Whether @fd was used since the last turn of the clock, see
+	 * insert_descriptor().  */
+	bool accessed;
+};
+
+/**
+ * Close the descriptors in @slots, the pool of a tree.
+ */
+static int slots_destructor(struct descriptor *slots)
+{
+	size_t nb_slots = talloc_get_size(slots) / sizeof(struct descriptor);
+	size_t i;
+
+	for (i = 0; i < nb_slots; i++) {
+		if (slots[i].node != NULL)
+			(void) close(slots[i].fd);
+	}
+
+	return 0;
+}
+
+/**
+ * Set to @max_descriptors the number of directories of @node's tree
+ * that keep an O_PATH descriptor, so as their children are opened,
+ * read and stat'ed relatively to this descriptor instead of their
+ * full actual path.  This number is limited by RLIMIT_NOFILE, and 0
+ * disables this mode.  Descriptors already opened are closed.  This
+ * function returns the actual number of descriptors.
+ */
+size_t set_directory_descriptors(Node *node, size_t max_descriptors)
+{
+	struct descriptor *slots = NULL;
+	Tree *tree = node->tree;
+	struct rlimit limit;
+	size_t i;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+		max_descriptors = MIN(max_descriptors, limit.rlim_cur / RLIMIT_FRACTION);
+
+	/* Descriptors are pinned only while the tree is locked.  */
+	write_lock_tree(tree);
+
+	if (max_descriptors > 0) {
+		slots = talloc_zero_array(tree, struct descriptor, max_descriptors);
+		if (slots == NULL)
+			max_descriptors = 0;
+		else {
+			talloc_set_name_const(slots, "$descriptors");
+			talloc_set_destructor(slots, slots_destructor);
+		}
+	}
+
+	for (i = 0; i < tree->descriptors.nb_slots; i++) {
+		if (tree->descriptors.slots[i].node != NULL)
+			tree->descriptors.slots[i].node->descriptor_index = 0;
+	}
+
+	TALLOC_FREE(tree->descriptors.slots);
+	tree->descriptors.slots    = slots;
+	tree->descriptors.nb_slots = 0;
+	tree->descriptors.hand     = 0;
+	__atomic_store_n(&tree->descriptors.max, max_descriptors, __ATOMIC_RELAXED);
+
+	write_unlock_tree(tree);
+
+	return max_descriptors;
+}
+
+/**
+ * Get the pool slot of @node's descriptor, if any, and pin it.  The
+ * pool has to be locked.
+ */
+static struct descriptor *pin_descriptor(Node *node)
+{
+	struct descriptor *slot;
+
+	if (node->descriptor_index == 0)
+		return NULL;
+
+	slot = &node->tree->descriptors.slots[node->descriptor_index - 1];
+	assert(slot->node == node);
+
+	slot->users++;
+	slot->accessed = true;
+
+	return slot;
+}
+
+/**
+ * Find a slot for a new descriptor in the pool of @tree: either a
+ * free one, or the first one not used since the last turn of the
+ * clock, as in evict_children().  The pool has to be locked.  This
+ * function returns NULL if all the descriptors are pinned.
+ */
+static struct descriptor *find_free_slot(Tree *tree)
+{
+	size_t max = tree->descriptors.max;
+	struct descriptor *slot;
+	size_t i;
+
+	if (tree->descriptors.nb_slots < max)
+		return &tree->descriptors.slots[tree->descriptors.nb_slots++];
+
+	for (i = 0; i < 2 * max; i++) {
+		slot = &tree->descriptors.slots[tree->descriptors.hand];
+		tree->descriptors.hand = (tree->descriptors.hand + 1) % max;
+
+		if (slot->node == NULL)
+			return slot;
+
+		if (slot->users > 0)
+			continue;
+
+		if (slot->accessed) {
+			slot->accessed = false;
+			continue;
+		}
+
+		slot->node->descriptor_index = 0;
+		(void) close(slot->fd);
+		slot->node = NULL;
+
+		return slot;
+	}
+
+	return NULL;
+}
+
+/**
+ * Open @node, a directory, with O_PATH: relatively to the descriptor
+ * of its parent if the actual path of @node is derived from the one
+ * of its parent, otherwise from its full actual path.  The tree has
+ * to be locked, at least for reading.  This function returns -errno
+ * if an error occurred, otherwise the new descriptor.
+ */
+static int open_path(Node *node)
+{
+	char path[PATH_MAX];
+	Directory parent;
+	int status;
+	int fd;
+
+	if (node->special || node->parent == node) {
+		if (render_path(node, ACTUAL_PATH, path, sizeof(path)) < 0)
+			return -ENAMETOOLONG;
+
+		fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+		return fd < 0 ? -errno : fd;
+	}
+
+	status = acquire_directory(node->parent, &parent);
+	if (status < 0)
+		return status;
+
+	fd = openat(parent.fd, node->name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	status = (fd < 0 ? -errno : fd);
+
+	release_directory(node->tree, &parent);
+
+	return status;
+}
+
+/**
+ * Get in @directory an O_PATH descriptor for @node, a directory.  It
+ * is opened only if it is not in the descriptor pool of the tree yet,
+ * then it is added to this latter.  This descriptor has to be
+ * released with release_directory() before the tree is unlocked.
+ * The tree has to be locked, at least for reading.  This function
+ * returns -errno if an error occurred, otherwise 0.
+ */
+int acquire_directory(Node *node, Directory *directory)
+{
+	Tree *tree = node->tree;
+	struct descriptor *slot;
+	int fd;
+
+	assert(node->type == DT_DIR);
+
+	pthread_mutex_lock(&tree->descriptors.lock);
+	slot = pin_descriptor(node);
+	pthread_mutex_unlock(&tree->descriptors.lock);
+
+	if (slot != NULL)
+		goto pinned;
+
+	/* Ancestors are opened -- and pinned -- without holding the
+	 * pool lock.  */
+	fd = open_path(node);
+	if (fd < 0)
+		return fd;
+
+	pthread_mutex_lock(&tree->descriptors.lock);
+
+	/* Another thread might have opened it in the meantime.  */
+	slot = pin_descriptor(node);
+	if (slot != NULL) {
+		pthread_mutex_unlock(&tree->descriptors.lock);
+		(void) close(fd);
+		goto pinned;
+	}
+
+	slot = find_free_slot(tree);
+	if (slot != NULL) {
+		slot->node     = node;
+		slot->fd       = fd;
+		slot->users    = 1;
+		slot->accessed = true;
+		node->descriptor_index = slot - tree->descriptors.slots + 1;
+	}
+
+	pthread_mutex_unlock(&tree->descriptors.lock);
+
+	/* All the descriptors are pinned, this one is closed once
+	 * released.  */
+	if (slot == NULL) {
+		directory->fd   = fd;
+		directory->slot = 0;
+		return 0;
+	}
+
+pinned:
+	directory->fd   = slot->fd;
+	directory->slot = slot - tree->descriptors.slots + 1;
+	return 0;
+}
+
+/**
+ * Release @directory, as acquired by acquire_directory() for a node of
+ * @tree.
+ */
+void release_directory(Tree *tree, Directory *directory)
+{
+	if (directory->slot == 0) {
+		(void) close(directory->fd);
+		return;
+	}
+
+	pthread_mutex_lock(&tree->descriptors.lock);
+	tree->descriptors.slots[directory->slot - 1].users--;
+	pthread_mutex_unlock(&tree->descriptors.lock);
+}
+
+/**
+ * Close the descriptor of @node, if any, because this node is deleted
+ * or its actual path has changed.  The tree has to be write-locked,
+ * so as no descriptors are pinned.
+ */
+void drop_descriptor(Node *node)
+{
+	Tree *tree = node->tree;
+	struct descriptor *slot;
+
+	assert(is_write_locked(tree));
+
+	if (node->descriptor_index == 0)
+		return;
+
+	slot = &tree->descriptors.slots[node->descriptor_index - 1];
+	assert(slot->users == 0);
+
+	(void) close(slot->fd);
+	slot->node = NULL;
+	node->descriptor_index = 0;
+}
+
+/**
+ * Open @node, a directory, for reading its entries.  Only the last
+ * component is walked by the kernel, see acquire_directory().  The
+ * tree has to be locked, at least for reading.  This function returns
+ * -errno if an error occurred, otherwise the new descriptor.
+ */
+int open_directory(Node *node)
+{
+	Directory directory;
+	int status;
+	int fd;
+
+	status = acquire_directory(node, &directory);
+	if (status < 0)
+		return status;
+
+	fd = openat(directory.fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	status = (fd < 0 ? -errno : fd);
+
+	release_directory(node->tree, &directory);
+
+	return status;
+}
+
+/**
+ * Get in @buffer the attributes in @mask of the entry @name of
+ * @parent, without following it if it is a symbolic link.  The tree
+ * has to be locked, at least for reading.  This function returns
+ * -errno if an error occurred, otherwise 0.
+ */
+int stat_child(Node *parent, const char *name, unsigned int mask, struct statx *buffer)
+{
+	Directory directory;
+	int status;
+
+	status = acquire_directory(parent, &directory);
+	if (status < 0)
+		return status;
+
+	status = statx(directory.fd, name, AT_SYMLINK_NOFOLLOW, mask, buffer);
+	if (status < 0)
+		status = -errno;
+
+	release_directory(parent->tree, &directory);
+
+	return status;
+}
+
+/**
+ * Read in @buffer, of @size bytes, the content of @node, a symbolic
+ * link, as readlink(2) does.  The tree has to be locked, at least
+ * for reading.  This function returns -errno if an error occurred,
+ * otherwise the number of bytes placed in @buffer.
+ */
+ssize_t read_link(Node *node, char *buffer, size_t size)
+{
+	char path[PATH_MAX];
+	Directory directory;
+	ssize_t status;
+
+	if (node->special || node->parent == node) {
+		if (render_path(node, ACTUAL_PATH, path, sizeof(path)) < 0)
+			return -ENAMETOOLONG;
+
+		status = readlink(path, buffer, size);
+		return status < 0 ? -errno : status;
+	}
+
+	status = acquire_directory(node->parent, &directory);
+	if (status < 0)
+		return status;
+
+	status = readlinkat(directory.fd, node->name, buffer, size);
+	if (status < 0)
+		status = -errno;
+
+	release_directory(node->tree, &directory);
+
+	return status;
+}
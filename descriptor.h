@@ -0,0 +1,60 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_DESCRIPTOR
+#define PROOT_VFS_DESCRIPTOR
+
+#include <stddef.h>	/* size_t, */
+#include <sys/types.h>	/* ssize_t, */
+#include <sys/stat.h>	/* struct statx, */
+#include <stdbool.h>	/* bool, */
+#include "vfs/node.h"
+#include "vfs/tree.h"
+
+/* O_PATH descriptor of a directory, pinned in the descriptor pool of
+ * its tree until released, see acquire_directory().  */
+typedef struct {
+	int fd;
+
+	/* Position + 1 of @fd in the pool, or 0 if @fd has to be
+	 * closed once released.  */
+	size_t slot;
+} Directory;
+
+extern size_t set_directory_descriptors(Node *node, size_t max_descriptors);
+extern int acquire_directory(Node *node, Directory *directory);
+extern void release_directory(Tree *tree, Directory *directory);
+extern void drop_descriptor(Node *node);
+extern int open_directory(Node *node);
+extern int stat_child(Node *parent, const char *name, unsigned int mask, struct statx *buffer);
+extern ssize_t read_link(Node *node, char *buffer, size_t size);
+
+/**
+ * Check whether directories of @tree are opened relatively to the
+ * descriptors of their parents, see set_directory_descriptors().
+ */
+static inline bool uses_descriptors(const Tree *tree)
+{
+	return __atomic_load_n(&tree->descriptors.max, __ATOMIC_RELAXED) > 0;
+}
+
+#endif /* PROOT_VFS_DESCRIPTOR */
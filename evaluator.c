@@ -0,0 +1,497 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <string.h>	/* str*(3), */
+#include <limits.h>	/* PATH_MAX, */
+#include <errno.h>	/* ENOMEM, EAGAIN, EIO, */
+#include <assert.h>	/* assert(3), */
+#include <dirent.h>	/* DT_*, */
+#include <fnmatch.h>	/* fnmatch(3), */
+#include <time.h>	/* clock_gettime(3), */
+#include <talloc.h>
+#include "vfs/evaluator.h"
+#include "vfs/node.h"
+#include "vfs/tree.h"
+#include "vfs/path.h"
+#include "vfs/memory.h"
+#include "vfs/children.h"
+#include "vfs/visit.h"
+
+/**
+ * Get the monotonic time, in nanoseconds.
+ */
+static uint64_t get_time(void)
+{
+	struct timespec now;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Forget that the evaluators of the tree were matched against @node,
+ * see register_evaluator().
+ */
+static int uncheck_node(Node *node, size_t depth, void *data)
+{
+	(void) depth;
+	(void) data;
+
+	node->evaluator_checked = false;
+
+	return 0;
+}
+
+/**
+ * Attach @evaluate to the nodes of @node's tree whose virtual path
+ * matches @pattern, as fnmatch(3) with FNM_PATHNAME does.  Nodes are
+ * matched lazily, the first time they are walked, and evaluators
+ * registered first are preferred.  @evaluate is called with @data
+ * each time the evaluation of a node has expired, that is, @ttl
+ * nanoseconds after the previous one, or once the tree is modified
+ * if @ttl is 0.  This function returns -errno if an error occurred,
+ * otherwise 0.
+ */
+int register_evaluator(Node *node, const char *pattern, Evaluate evaluate,
+		void *data, uint64_t ttl)
+{
+	Tree *tree = node->tree;
+	Evaluator **slots;
+	Evaluator *evaluator;
+	int status = 0;
+	Node *root;
+
+	write_lock_tree(tree);
+
+	evaluator = talloc_zero(tree, Evaluator);
+	if (evaluator == NULL) {
+		status = -ENOMEM;
+		goto end;
+	}
+
+	talloc_set_name_const(evaluator, "$evaluator");
+
+	evaluator->pattern = talloc_strdup(evaluator, pattern);
+	if (evaluator->pattern == NULL) {
+		TALLOC_FREE(evaluator);
+		status = -ENOMEM;
+		goto end;
+	}
+
+	evaluator->evaluate = evaluate;
+	evaluator->data     = data;
+	evaluator->ttl      = ttl;
+
+	slots = talloc_realloc(tree, tree->evaluators.slots, Evaluator *,
+			tree->evaluators.nb_slots + 1);
+	if (slots == NULL) {
+		TALLOC_FREE(evaluator);
+		status = -ENOMEM;
+		goto end;
+	}
+
+	slots[tree->evaluators.nb_slots] = evaluator;
+	tree->evaluators.slots = slots;
+	tree->evaluators.nb_slots++;
+
+	/* Nodes are matched again, and lookup results that went
+	 * through them are not valid anymore.  */
+	for (root = node; root->parent != root; root = root->parent)
+		;
+	(void) visit_tree(root, uncheck_node, NULL, NULL);
+	bump_generation(node);
+
+end:
+	write_unlock_tree(tree);
+
+	return status;
+}
+
+/**
+ * Register in @node's tree the evaluators of @from's tree, as
+ * register_evaluator() does, see clone_tree().  This function
+ * returns -errno if an error occurred, otherwise 0.
+ */
+int copy_evaluators(Node *node, const Node *from)
+{
+	const Tree *tree = from->tree;
+	Evaluator *copies;
+	size_t nb_copies;
+	int status = 0;
+	size_t i;
+
+	/* Both trees can't be locked at the same time.  */
+	read_lock_tree((Tree *) tree);
+
+	nb_copies = tree->evaluators.nb_slots;
+	copies = talloc_array(NULL, Evaluator, nb_copies);
+	for (i = 0; copies != NULL && i < nb_copies; i++) {
+		copies[i] = *tree->evaluators.slots[i];
+		copies[i].pattern = talloc_strdup(copies, copies[i].pattern);
+		if (copies[i].pattern == NULL)
+			TALLOC_FREE(copies);
+	}
+
+	read_unlock_tree((Tree *) tree);
+
+	if (copies == NULL)
+		return nb_copies != 0 ? -ENOMEM : 0;
+
+	for (i = 0; i < nb_copies && status >= 0; i++)
+		status = register_evaluator(node, copies[i].pattern, copies[i].evaluate,
+					copies[i].data, copies[i].ttl);
+
+	talloc_free(copies);
+
+	return status;
+}
+
+/**
+ * Set the target of the node being evaluated to a copy of @target,
+ * see Evaluate.  This function returns -ENOMEM if there's not enough
+ * memory, otherwise 0.
+ */
+int set_evaluated_symlink(Evaluation *evaluation, const char *target)
+{
+	char *symlink;
+
+	symlink = talloc_strdup(evaluation, target);
+	if (symlink == NULL)
+		return -ENOMEM;
+
+	talloc_free(evaluation->symlink);
+	evaluation->symlink = symlink;
+	evaluation->type    = DT_LNK;
+
+	return 0;
+}
+
+/**
+ * Add a child named @name, of the given @type, to the node being
+ * evaluated, see Evaluate.  Its actual children are replaced with
+ * the ones added this way.  This function returns -ENOMEM if there's
+ * not enough memory, otherwise 0.
+ */
+int add_evaluated_child(Evaluation *evaluation, const char *name, int type)
+{
+	EvaluatedChild *children;
+	char *copy;
+
+	copy = talloc_strdup(evaluation, name);
+	if (copy == NULL)
+		return -ENOMEM;
+
+	children = talloc_realloc(evaluation, evaluation->children, EvaluatedChild,
+				evaluation->nb_children + 1);
+	if (children == NULL) {
+		talloc_free(copy);
+		return -ENOMEM;
+	}
+
+	children[evaluation->nb_children].name = copy;
+	children[evaluation->nb_children].type = type;
+
+	evaluation->children = children;
+	evaluation->nb_children++;
+	evaluation->has_children = true;
+	evaluation->type = DT_DIR;
+
+	return 0;
+}
+
+/**
+ * Estimate the memory used by @evaluation, if not NULL.
+ */
+size_t evaluation_footprint(const Evaluation *evaluation)
+{
+	size_t size;
+	size_t i;
+
+	if (evaluation == NULL)
+		return 0;
+
+	size = TALLOC_CHUNK_SIZE(sizeof(Evaluation)) + string_footprint(evaluation->symlink);
+
+	if (evaluation->children != NULL)
+		size += TALLOC_CHUNK_SIZE(evaluation->nb_children * sizeof(EvaluatedChild));
+
+	for (i = 0; i < evaluation->nb_children; i++)
+		size += string_footprint(evaluation->children[i].name);
+
+	return size;
+}
+
+/**
+ * Check whether @a and @b would modify a node the same way.
+ */
+static bool is_same_evaluation(const Evaluation *a, const Evaluation *b)
+{
+	size_t i;
+
+	if (   a->error != b->error
+	    || a->type != b->type
+	    || a->has_children != b->has_children
+	    || a->nb_children != b->nb_children)
+		return false;
+
+	if ((a->symlink == NULL) != (b->symlink == NULL))
+		return false;
+
+	if (a->symlink != NULL && strcmp(a->symlink, b->symlink) != 0)
+		return false;
+
+	for (i = 0; i < a->nb_children; i++) {
+		if (   a->children[i].type != b->children[i].type
+		    || strcmp(a->children[i].name, b->children[i].name) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Check whether @evaluation, made for a node of @tree, has expired.
+ */
+static bool has_expired(const Tree *tree, const Evaluation *evaluation)
+{
+	if (evaluation->expiry != 0)
+		return get_time() >= evaluation->expiry;
+
+	return evaluation->generation != get_generation(tree);
+}
+
+/**
+ * Check whether @node is still as modified by @evaluation, that is,
+ * its evaluated children were not evicted.
+ */
+static bool is_applied(const Node *node, const Evaluation *evaluation)
+{
+	return evaluation->error < 0 || !evaluation->has_children || node->children_filled;
+}
+
+/**
+ * Count that the evaluation of a node by @evaluator was reused.
+ */
+static void count_hit(Tree *tree, Evaluator *evaluator)
+{
+	__atomic_add_fetch(&evaluator->hits, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&tree->evaluators.hits, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the result of the evaluation of @node if it can be used as is,
+ * as evaluate_node() would do.  The tree has to be locked, at least
+ * for reading.  This function returns -EAGAIN if @node has to be
+ * evaluated with the tree write-locked, otherwise the error of this
+ * evaluation.
+ */
+int load_evaluation(Node *node, bool *is_volatile)
+{
+	Evaluator *evaluator = (Evaluator *) node->attached_evaluator;
+	const Evaluation *evaluation = node->evaluation_;
+
+	if (!node->evaluator_checked)
+		return -EAGAIN;
+
+	if (evaluator == NULL)
+		return 0;
+
+	if (evaluation == NULL || has_expired(node->tree, evaluation) || !is_applied(node, evaluation))
+		return -EAGAIN;
+
+	count_hit(node->tree, evaluator);
+
+	if (evaluator->ttl != 0)
+		*is_volatile = true;
+
+	return evaluation->error;
+}
+
+/**
+ * Attach to @node the first evaluator of its tree whose pattern
+ * matches its virtual path.  The tree has to be write-locked.
+ */
+static void attach_evaluator(Node *node)
+{
+	const Tree *tree = node->tree;
+	const Evaluator *evaluator = NULL;
+	char path[PATH_MAX];
+	size_t i;
+
+	if (render_path(node, VIRTUAL_PATH, path, sizeof(path)) >= 0) {
+		for (i = 0; i < tree->evaluators.nb_slots; i++) {
+			if (fnmatch(tree->evaluators.slots[i]->pattern, path, FNM_PATHNAME) == 0) {
+				evaluator = tree->evaluators.slots[i];
+				break;
+			}
+		}
+	}
+
+	if (evaluator != node->attached_evaluator) {
+		account_memory(node->tree, -evaluation_footprint(node->evaluation_));
+		TALLOC_FREE(node->evaluation_);
+		node->attached_evaluator = evaluator;
+	}
+
+	node->evaluator_checked = true;
+}
+
+/**
+ * Modify @node as described by @evaluation: its type, its target
+ * and its children.  Previous children are flushed if @evaluation
+ * replaces them.  The tree has to be write-locked.  This function
+ * returns -errno if an error occurred, otherwise 0.
+ */
+static int apply_evaluation(Node *node, const Evaluation *evaluation)
+{
+	char *symlink;
+	size_t i;
+
+	if (evaluation->error < 0)
+		return 0;
+
+	if (evaluation->type != 0)
+		node->type = evaluation->type;
+
+	if (evaluation->symlink != NULL
+	    && (node->symlink_ == NULL || strcmp(node->symlink_, evaluation->symlink) != 0)) {
+		symlink = talloc_strdup(node, evaluation->symlink);
+		if (symlink == NULL)
+			return -ENOMEM;
+
+		talloc_set_name_const(symlink, "$symlink");
+
+		account_memory(node->tree, -string_footprint(node->symlink_));
+		TALLOC_FREE(node->symlink_);
+
+		account_memory(node->tree, string_footprint(symlink));
+		__atomic_store_n(&node->symlink_, symlink, __ATOMIC_RELEASE);
+	}
+
+	if (!evaluation->has_children)
+		return 0;
+
+	if (node->children.nb_nodes != 0)
+		(void) flush_children(node, false);
+
+	for (i = 0; i < evaluation->nb_children; i++) {
+		const EvaluatedChild *child = &evaluation->children[i];
+
+		if (find_in_index(node, child->name, -1) != NULL)
+			continue;
+
+		if (add_new_child(node, child->name, -1, child->type) == NULL)
+			return -ENOMEM;
+	}
+
+	node->children_filled = true;
+
+	return 0;
+}
+
+/**
+ * Evaluate @node with its evaluator, if any, unless its previous
+ * evaluation can be used as is, then modify @node accordingly.
+ * Everything computed from the previous evaluation is invalidated
+ * if the new one differs.  *@is_volatile is set to true if this
+ * evaluation expires with time, so as results that depend on it are
+ * not cached.  The tree has to be write-locked.  This function
+ * returns -errno if an error occurred or if the lookup of @node has
+ * to fail, otherwise 0.
+ */
+int evaluate_node(Node *node, bool *is_volatile)
+{
+	Tree *tree = node->tree;
+	Evaluation *previous;
+	Evaluation *evaluation;
+	Evaluator *evaluator;
+	int status;
+
+	assert(is_write_locked(tree));
+
+	if (!node->evaluator_checked)
+		attach_evaluator(node);
+
+	evaluator = (Evaluator *) node->attached_evaluator;
+	if (evaluator == NULL)
+		return 0;
+
+	if (evaluator->ttl != 0)
+		*is_volatile = true;
+
+	previous = node->evaluation_;
+
+	/* Only the children might have to be added again.  */
+	if (previous != NULL && !has_expired(tree, previous)) {
+		count_hit(tree, evaluator);
+
+		if (is_applied(node, previous))
+			return previous->error;
+
+		status = apply_evaluation(node, previous);
+		if (previous->expiry == 0)
+			previous->generation = get_generation(tree);
+
+		return status < 0 ? status : previous->error;
+	}
+
+	evaluation = talloc_zero(node, Evaluation);
+	if (evaluation == NULL)
+		return -ENOMEM;
+
+	talloc_set_name_const(evaluation, "$evaluation");
+
+	__atomic_add_fetch(&evaluator->calls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&tree->evaluators.calls, 1, __ATOMIC_RELAXED);
+
+	/* -EAGAIN means the tree has to be write-locked during a
+	 * walk, see walk_locked(), so it can't be reported as is.  */
+	status = evaluator->evaluate(node, evaluation, evaluator->data);
+	if (status == -EAGAIN)
+		status = -EIO;
+	if (status < 0)
+		evaluation->error = status;
+
+	/* Lookups that went through @node are not valid anymore, as
+	 * well as the resolution of links.  */
+	if (previous != NULL && !is_same_evaluation(previous, evaluation))
+		bump_generation(node);
+
+	if (previous == NULL || !is_same_evaluation(previous, evaluation)
+	    || (evaluation->has_children && !node->children_filled)) {
+		status = apply_evaluation(node, evaluation);
+		if (status < 0) {
+			talloc_free(evaluation);
+			return status;
+		}
+	}
+
+	if (evaluator->ttl != 0)
+		evaluation->expiry = get_time() + evaluator->ttl;
+	evaluation->generation = get_generation(tree);
+
+	account_memory(tree, evaluation_footprint(evaluation) - evaluation_footprint(previous));
+	talloc_free(previous);
+	node->evaluation_ = evaluation;
+
+	return evaluation->error;
+}
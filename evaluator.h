@@ -0,0 +1,106 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_EVALUATOR
+#define PROOT_VFS_EVALUATOR
+
+#include <stddef.h>	/* size_t, */
+#include <stdint.h>	/* uint64_t, */
+#include <stdbool.h>	/* bool, */
+#include "vfs/node.h"
+#include "vfs/tree.h"
+
+/* Entry synthesized by an evaluator, see add_evaluated_child().  */
+typedef struct {
+	char *name;
+	int type;
+} EvaluatedChild;
+
+/* What an evaluator produced for a node, it is cached in this latter
+ * until it expires, see evaluate_node().  */
+typedef struct evaluation {
+	/* Either -errno, so as the lookup of the node fails, or 0.  */
+	int error;
+
+	/* Type of the node, as in linux_dirent->d_type, or 0 to keep
+	 * its current type.  */
+	int type;
+
+	/* Target of the node, if it is a symbolic link, see
+	 * set_evaluated_symlink().  */
+	char *symlink;
+
+	/* Children of the node, if they replace the actual ones, see
+	 * add_evaluated_child().  */
+	EvaluatedChild *children;
+	size_t nb_children;
+	bool has_children;
+
+	/* Monotonic time when this evaluation expires, or 0 if it is
+	 * valid as long as the generation of the tree is @generation.  */
+	uint64_t expiry;
+	size_t generation;
+} Evaluation;
+
+/* Fill @evaluation for @node, with the tree write-locked.  This
+ * function returns -errno if the lookup of @node has to fail,
+ * otherwise 0; -EAGAIN is reported as -EIO.  */
+typedef int (*Evaluate)(Node *node, Evaluation *evaluation, void *data);
+
+/* Evaluator attached to the nodes whose virtual path matches
+ * @pattern, see register_evaluator().  */
+typedef struct evaluator {
+	char *pattern;
+	Evaluate evaluate;
+	void *data;
+
+	/* Lifetime of the evaluations in nanoseconds, or 0 if they
+	 * are valid until the tree is modified.  */
+	uint64_t ttl;
+
+	/* Number of evaluations, and of lookups that reused one.  */
+	size_t calls;
+	size_t hits;
+} Evaluator;
+
+extern int register_evaluator(Node *node, const char *pattern, Evaluate evaluate,
+			void *data, uint64_t ttl);
+extern int copy_evaluators(Node *node, const Node *from);
+extern int set_evaluated_symlink(Evaluation *evaluation, const char *target);
+extern int add_evaluated_child(Evaluation *evaluation, const char *name, int type);
+extern int load_evaluation(Node *node, bool *is_volatile);
+extern int evaluate_node(Node *node, bool *is_volatile);
+extern size_t evaluation_footprint(const Evaluation *evaluation);
+
+/**
+ * Check whether @node might have to be evaluated before being
+ * walked: either it has an evaluator, or the evaluators of its tree
+ * were not matched against it yet.  The tree has to be locked, at
+ * least for reading.
+ */
+static inline bool needs_evaluator(const Node *node)
+{
+	return node->tree->evaluators.nb_slots != 0
+		&& (!node->evaluator_checked || node->attached_evaluator != NULL);
+}
+
+#endif /* PROOT_VFS_EVALUATOR */
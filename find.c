@@ -20,87 +20,292 @@
  * 02110-1301 USA.
  */
 
-#include <sys/param.h>	/* MAXSYMLINKS, */
+#include <sys/param.h>	/* MAXSYMLINKS, MAX, */
 #include <errno.h>	/* E*, */
 #include <dirent.h>	/* DT_*, */
 #include <assert.h>	/* assert(3), */
-#include <string.h>	/* str*spn(3), */
+#include <string.h>	/* strcmp(3), memcpy(3), */
+#include <stdlib.h>	/* malloc(3), qsort(3), */
 #include <stdbool.h>	/* bool, */
 #include <fcntl.h>	/* O_NOFOLLOW, O_CREATE, */
 #include "vfs/find.h"
 #include "vfs/node.h"
 #include "vfs/symlink.h"
 #include "vfs/children.h"
+#include "vfs/cache.h"
+#include "vfs/tree.h"
+#include "vfs/memory.h"
+#include "vfs/watch.h"
+#include "vfs/component.h"
+#include "vfs/path.h"
+#include "vfs/stats.h"
+#include "vfs/evaluator.h"
+#include "vfs/clone.h"
+
+/* Maximum number of components shared by the paths of a batch, see
+ * find_nodes().  Deeper components are simply not shared.  */
+#define PREFIX_MAX_COMPONENTS 64
+
+/* Nodes found for the intermediate components of the last path
+ * walked in a batch, see find_nodes().  */
+typedef struct {
+	const char *path;
+	size_t nb_components;
+	struct {
+		/* Offset of the end of this component in @path.  */
+		size_t end;
+		Node *node;
+	} components[PREFIX_MAX_COMPONENTS];
+} Prefix;
+
+/* State of a lookup, shared by the nested walks of find_node_().  */
+typedef struct {
+	Node *root;
+
+	/* Whether the tree is write-locked.  If not, the walk stops
+	 * with -EAGAIN instead of modifying the tree.  */
+	bool writable;
+
+	/* Directory to fill before walking again, when the walk
+	 * stopped with -EAGAIN.  */
+	Node *unfilled;
+
+	/* Directory that couldn't be filled before this walk.  */
+	const Node *unfillable;
+
+	/* Highest symlink count reached so far, and whether a child
+	 * was reported missing from a directory that isn't filled,
+	 * see follow_symlink_node().  */
+	size_t depth;
+	bool incomplete;
+
+	/* Whether an evaluation that expires with time was used, so
+	 * as the result can't be cached, see evaluate_node().  */
+	bool is_volatile;
+
+	/* Where intermediate components are recorded, if not NULL.  */
+	Prefix *prefix;
+
+	/* Whether a missing final component is reported in @missing
+	 * instead of being created, when O_CREAT is set.  */
+	bool is_translation;
+	struct {
+		const Node *parent;
+		Component component;
+	} missing;
+} Walk;
+
+static Node *walk_path(Walk *walk, Node *node, const char *path, int flags,
+		int *error, size_t symlink_count);
 
 /**
- * Find in @root file-system the node pointed to by @node.  This
+ * Find in @walk->root file-system the node pointed to by @node.  This
  * function returns NULL if an error occurred, and *@error is set to
  * -errno.
+ *
+ * The result is memoized in @node until the tree is modified, so as
+ * chains of links are not walked again at each lookup.  This result
+ * is still valid for another @symlink_count, as long as the highest
+ * count reached from there doesn't exceed MAXSYMLINKS.
  */
-static Node *follow_symlink_node(Node *root, Node *node, int *error, size_t symlink_count)
+static Node *follow_symlink_node(Walk *walk, Node *node, int *error, size_t symlink_count)
 {
+	Resolution resolution;
+	Prefix *prefix;
+	bool is_volatile;
+	bool incomplete;
+	size_t depth;
 	const char *symlink;
+	Node *target;
+
+	count_stat(node->tree, STAT_SYMLINK_HOPS, 1);
+
+	if (load_resolution(node, &resolution) && resolution.root == walk->root) {
+		/* A loop found from a given count is found from any
+		 * higher count.  */
+		if (resolution.error == -ELOOP) {
+			if (symlink_count >= resolution.count) {
+				*error = -ELOOP;
+				return NULL;
+			}
+		}
+		else if (symlink_count + resolution.depth > MAXSYMLINKS) {
+			*error = -ELOOP;
+			return NULL;
+		}
+		else {
+			walk->depth = MAX(walk->depth, symlink_count + resolution.depth);
+			*error = resolution.error;
+			return resolution.target;
+		}
+	}
 
-	if (symlink_count++ > MAXSYMLINKS) {
+	if (symlink_count > MAXSYMLINKS) {
 		*error = -ELOOP;
 		return NULL;
 	}
 
-	symlink = get_symlink(node, error);
-	if (symlink == NULL)
-		return NULL;
+	symlink = __atomic_load_n(&node->symlink_, __ATOMIC_ACQUIRE);
+	if (symlink == NULL) {
+		if (!walk->writable) {
+			*error = -EAGAIN;
+			return NULL;
+		}
+
+		symlink = get_symlink(node, error);
+		if (symlink == NULL)
+			return NULL;
+	}
+
+	depth       = walk->depth;
+	incomplete  = walk->incomplete;
+	is_volatile = walk->is_volatile;
+	prefix      = walk->prefix;
 
-	return find_node_(root, node->parent, symlink, 0, error, symlink_count);
+	walk->depth       = symlink_count;
+	walk->incomplete  = false;
+	walk->is_volatile = (   node->attached_evaluator != NULL
+			     && node->attached_evaluator->ttl != 0);
+	walk->prefix      = NULL;
+
+	target = walk_path(walk, symlink[0] == '/' ? walk->root : node->parent,
+			symlink, 0, error, symlink_count + 1);
+
+	walk->prefix = prefix;
+
+	/* Only results that don't depend on the current state of the
+	 * lookup, nor on the current time, are memoized.  */
+	if (   !walk->is_volatile
+	    && (   target != NULL
+		|| *error == -ELOOP
+		|| ((*error == -ENOENT || *error == -ENOTDIR) && !walk->incomplete))) {
+		resolution.error  = target != NULL ? 0 : *error;
+		resolution.target = target;
+		resolution.root   = walk->root;
+		resolution.count  = symlink_count;
+		resolution.depth  = walk->depth - symlink_count;
+		store_resolution(node, &resolution);
+	}
+
+	walk->depth        = MAX(depth, walk->depth);
+	walk->incomplete  |= incomplete;
+	walk->is_volatile |= is_volatile;
+
+	return target;
+}
+
+/**
+ * Flush what @node got from its previous actual path if a binding
+ * was changed since it was checked, see revalidate_node().  This
+ * function returns -EAGAIN if the tree has to be write-locked
+ * first, otherwise as revalidate_node().
+ */
+static int check_binding(const Walk *walk, Node *node)
+{
+	if (!is_binding_stale(node))
+		return 0;
+
+	if (!walk->writable)
+		return -EAGAIN;
+
+	return revalidate_node(node);
 }
 
 /**
- * Get @node's child with given @name.  This function handles special
+ * Get @node's child for @component.  This function handles special
  * names "." and "..", respectively @node and @node->parent.  Also, it
- * fills @node's children list if needed.
+ * fills @node's children list if needed.  This function returns NULL
+ * if there's no such child or if an error occurred, and *@error is
+ * then set to -errno.
  */
-static Node *get_child(Node *node, const char *name, ssize_t length)
+static Node *get_child(Walk *walk, Node *node, const Component *component, int *error)
 {
+	const char *name = component->name;
+	size_t length = component->length;
 	Node *child = NULL;
 
 	assert(node->type == DT_DIR);
 
-	if (length < 0)
-		length = strlen(name);
+	*error = 0;
 
-	if (length == 1 && strncmp(name, ".", length) == 0)
+	if (component->kind == COMPONENT_DOT)
 		return node;
 
-	if (length == 2 && strncmp(name, "..", length) == 0)
+	if (component->kind == COMPONENT_DOTDOT)
 		return node->parent;
 
-	if (!node->children_filled)
-		(void) fill_children(node);
+	touch_directory(node);
+
+	child = find_hashed_in_index(node, name, length, component->hash);
+
+	if (child == NULL && !node->children_filled && node != walk->unfillable) {
+		/* Clones get only the looked up child from their
+		 * original tree, when it has the same listing.  */
+		bool partial = (node->tree->lazy_lookup
+				|| (has_origin(node->tree) && has_origin_listing(node)));
+
+		if (!walk->writable) {
+			if (!partial)
+				walk->unfilled = node;
+			*error = -EAGAIN;
+			return NULL;
+		}
+
+		/* Negative children are not returned by
+		 * lookup_child().  */
+		if (partial)
+			child = lookup_child(node, name, length);
+		else
+			(void) fill_children(node);
+
+		if (child == NULL)
+			child = find_hashed_in_index(node, name, length, component->hash);
+	}
+
+	if (child == NULL && !node->children_filled)
+		walk->incomplete = true;
+
+	if (child != NULL && child->negative)
+		return NULL;
 
-	HASH_FIND(hh, node->children, name, length, child);
 	return child;
 }
 
 /**
- * Find in @root file-system the node for @path, relatively to @from
- * if not absolute.  @flags is a bit mask that can contain O_NOFOLLOW
- * and/or O_CREATE.  This function returns NULL if an error occurred,
- * and *@error is set to -errno.
+ * Record in @prefix that the component of @prefix->path ending at
+ * @end resolves to @node.
  */
-Node *find_node_(Node *root, Node *from, const char *path, int flags,
+static void push_component(Prefix *prefix, const char *end, Node *node)
+{
+	size_t index = prefix->nb_components;
+
+	if (index == PREFIX_MAX_COMPONENTS)
+		return;
+
+	prefix->components[index].end  = end - prefix->path;
+	prefix->components[index].node = node;
+	prefix->nb_components++;
+}
+
+/**
+ * Walk @walk->root file-system from @node, component by component,
+ * to find the node for @path.  See find_node_() for the meaning of
+ * the other parameters.  The tree has to be locked, at least for
+ * reading.
+ */
+static Node *walk_path(Walk *walk, Node *node, const char *path, int flags,
 		int *error, size_t symlink_count)
 {
 	bool follow_symlink = ((flags & O_NOFOLLOW) == 0);
 	bool create = ((flags & O_CREAT) != 0);
-	Node *node;
 
-	if (path[0] == '/')
-		node = root;
-	else
-		node = from;
+	*error = check_binding(walk, node);
+	if (*error < 0)
+		return NULL;
 
 	while (path[0] != '\0') {
+		Component component;
 		Node *parent_node;
-		size_t length;
 		bool is_final;
 
 		if (node->type != DT_DIR) {
@@ -109,13 +314,17 @@ Node *find_node_(Node *root, Node *from, const char *path, int flags,
 		}
 
 		/* Find component boundaries.  */
-		path += strspn(path, "/");
-		length = strcspn(path, "/");
-		is_final = (path[length] == '\0');
+		path = next_component(path, &component);
+		is_final = (path[0] == '\0');
+
+		count_stat(node->tree, STAT_COMPONENTS, 1);
 
 		parent_node = node;
-		node = get_child(node, path, length);
+		node = get_child(walk, node, &component, error);
 		if (node == NULL) {
+			if (*error == -EAGAIN)
+				return NULL;
+
 			if (!is_final) {
 				*error = -ENOTDIR;
 				return NULL;
@@ -126,26 +335,441 @@ Node *find_node_(Node *root, Node *from, const char *path, int flags,
 				return NULL;
 			}
 
-			node = add_new_child(parent_node, path, length, 0 /* DT_UNKNOWN */);
-			if (node == NULL) {
-				*error = -ENOMEM;
+			if (walk->is_translation) {
+				walk->missing.parent    = parent_node;
+				walk->missing.component = component;
+				*error = -ENOENT;
 				return NULL;
 			}
 
+			if (!walk->writable) {
+				*error = -EAGAIN;
+				return NULL;
+			}
+
+			/* Recycle the negative child, if any.  */
+			node = find_hashed_in_index(parent_node, component.name,
+						component.length, component.hash);
+			if (node != NULL) {
+				assert(node->negative);
+				node->negative = false;
+				node->type = 0 /* DT_UNKNOWN */;
+			}
+			else {
+				node = add_new_child(parent_node, component.name, component.length,
+						0 /* DT_UNKNOWN */);
+				if (node == NULL) {
+					*error = -ENOMEM;
+					return NULL;
+				}
+			}
+
+			/* Symlinks resolved to -ENOENT might now be
+			 * resolved to this node.  */
+			__atomic_add_fetch(&node->tree->creations, 1, __ATOMIC_RELEASE);
+
 			/* Early exit; it's the final component
 			 * anyway.  */
 			break;
 		}
 
-		/* Move to the next component.  */
-		path += length;
+		*error = check_binding(walk, node);
+		if (*error < 0)
+			return NULL;
+
+		/* Virtual nodes are evaluated before being walked.  */
+		if (needs_evaluator(node)) {
+			*error = load_evaluation(node, &walk->is_volatile);
+			if (*error == -EAGAIN && walk->writable)
+				*error = evaluate_node(node, &walk->is_volatile);
+			if (*error < 0)
+				return NULL;
+		}
 
 		if (node->type == DT_LNK && (!is_final || follow_symlink)) {
-			node = follow_symlink_node(root, node, error, symlink_count);
+			node = follow_symlink_node(walk, node, error, symlink_count);
 			if (node == NULL)
 				return NULL;
 		}
+
+		/* Volatile nodes have to be evaluated again each time
+		 * they are walked, so as their descendants.  */
+		if (walk->prefix != NULL && !is_final && !walk->is_volatile)
+			push_component(walk->prefix, path, node);
 	}
 
 	return node;
 }
+
+/**
+ * Walk @walk->root file-system from @start to find the node for
+ * @path, as find_node_() does, then store it in the lookup cache
+ * through @key.  The tree is left locked, for writing if
+ * @walk->writable, otherwise for reading, so as the result can be
+ * used safely.  This function returns NULL if an error occurred, and
+ * *@error is set to -errno.
+ */
+static Node *walk_locked(Walk *walk, Node *start, const char *path, int flags,
+			int *error, size_t symlink_count, LookupKey *key)
+{
+	Tree *tree = walk->root->tree;
+	Node *node;
+
+	while (1) {
+		Fill fill;
+		int status;
+
+		if (walk->writable)
+			write_lock_tree(tree);
+		else
+			read_lock_tree(tree);
+
+		walk->unfilled       = NULL;
+		walk->depth          = symlink_count;
+		walk->incomplete     = false;
+		walk->is_volatile    = false;
+		walk->missing.parent = NULL;
+		node = walk_path(walk, start, path, flags, error, symlink_count);
+
+		/* Nothing else can be done once write-locked.  */
+		if (node != NULL || *error != -EAGAIN || walk->writable) {
+			if (node != NULL && !walk->is_volatile)
+				lookup_cache_put(key, node);
+			return node;
+		}
+
+		/* Something has to be modified in the tree.  */
+		if (walk->unfilled == NULL) {
+			read_unlock_tree(tree);
+			walk->writable = true;
+			continue;
+		}
+
+		status = start_fill(&fill, walk->unfilled);
+		read_unlock_tree(tree);
+
+		if (status >= 0)
+			status = finish_fill(&fill);
+
+		/* This directory can't be filled, don't try again
+		 * during this lookup, as previously.  */
+		if (status < 0)
+			walk->unfillable = walk->unfilled;
+	}
+}
+
+/**
+ * Count in @tree the failure of a top-level lookup with @error, if
+ * @node is NULL.
+ */
+static inline void count_failure(Tree *tree, const Node *node, int error)
+{
+	if (node != NULL)
+		return;
+
+	if (error == -ELOOP)
+		count_stat(tree, STAT_ELOOP, 1);
+	else if (error == -ENOENT)
+		count_stat(tree, STAT_ENOENT, 1);
+}
+
+/**
+ * Unlock @tree as left locked by walk_locked().
+ */
+static void unlock_walk(const Walk *walk, Tree *tree)
+{
+	if (walk->writable)
+		write_unlock_tree(tree);
+	else
+		read_unlock_tree(tree);
+}
+
+/**
+ * Find in @root file-system the node for @path, relatively to @from
+ * if not absolute.  @flags is a bit mask that can contain O_NOFOLLOW
+ * and/or O_CREATE.  This function returns NULL if an error occurred,
+ * and *@error is set to -errno.
+ *
+ * Concurrent lookups are allowed: the tree is walked with the read
+ * lock held, and directories are filled without holding any lock.
+ * Anything else that has to modify the tree makes the walk start
+ * over with the write lock held.
+ */
+Node *find_node_(Node *root, Node *from, const char *path, int flags,
+		int *error, size_t symlink_count)
+{
+	Tree *tree = root->tree;
+	Walk walk = { .root = root };
+	uint64_t start_time;
+	LookupKey key;
+	Node *start;
+	Node *node;
+
+	if (path[0] == '/')
+		start = root;
+	else
+		start = from;
+
+	/* Results of nested lookups depend on @symlink_count, so only
+	 * top-level lookups are cached.  */
+	key.slot = NULL;
+	if (symlink_count == 0) {
+		start_time = start_latency();
+
+		drain_watch_events(tree, false);
+
+		/* The parent of the node can't be deleted while it is
+		 * touched.  */
+		read_lock_tree(tree);
+
+		node = lookup_cache_get(&key, root, start, path, flags);
+		if (node != NULL)
+			touch_directory(node->parent);
+
+		read_unlock_tree(tree);
+
+		if (node != NULL) {
+			record_latency(tree, LATENCY_FIND_NODE, start_time);
+			return node;
+		}
+	}
+
+	node = walk_locked(&walk, start, path, flags, error, symlink_count, &key);
+
+	unlock_walk(&walk, tree);
+
+	if (symlink_count == 0) {
+		count_failure(tree, node, *error);
+		record_latency(tree, LATENCY_FIND_NODE, start_time);
+	}
+
+	return node;
+}
+
+/**
+ * Write in @buffer, of @size bytes, the actual path of the file for
+ * @path in @root file-system, where @from and @flags are as for
+ * find_node().  As opposed to get_path(find_node()), no path is
+ * cached in the nodes, and if O_CREAT is set, a missing final
+ * component is not added to the tree: its name is appended to the
+ * actual path of its parent instead.  Nothing is allocated when the
+ * lookup cache has the node already.  This function returns -errno
+ * if an error occurred, otherwise the length of the actual path.
+ */
+ssize_t translate_path(Node *root, Node *from, const char *path, int flags,
+		char *buffer, size_t size)
+{
+	Tree *tree = root->tree;
+	Walk walk = { .root = root, .is_translation = true };
+	const Component *missing;
+	ssize_t length;
+	LookupKey key;
+	Node *start;
+	Node *node;
+	int error;
+
+	start = (path[0] == '/' ? root : from);
+
+	drain_watch_events(tree, false);
+
+	/* The node can't be evicted while its path is rendered.  */
+	read_lock_tree(tree);
+
+	node = lookup_cache_get(&key, root, start, path, flags);
+	if (node != NULL) {
+		touch_directory(node->parent);
+		length = render_path(node, ACTUAL_PATH, buffer, size);
+		read_unlock_tree(tree);
+		return length;
+	}
+
+	read_unlock_tree(tree);
+
+	node = walk_locked(&walk, start, path, flags, &error, 0, &key);
+	if (node != NULL)
+		length = render_path(node, ACTUAL_PATH, buffer, size);
+	else if (walk.missing.parent == NULL) {
+		count_failure(tree, node, error);
+		length = error;
+	}
+	else {
+		missing = &walk.missing.component;
+
+		length = render_path(walk.missing.parent, ACTUAL_PATH, buffer, size);
+		if (length >= 0 && missing->length > 0) {
+			bool needs_separator = (length == 0 || buffer[length - 1] != '/');
+
+			if (length + needs_separator + missing->length >= size)
+				length = -ERANGE;
+			else {
+				if (needs_separator)
+					buffer[length++] = '/';
+
+				memcpy(buffer + length, missing->name, missing->length);
+				length += missing->length;
+				buffer[length] = '\0';
+			}
+		}
+	}
+
+	unlock_walk(&walk, tree);
+
+	return length;
+}
+
+/**
+ * Get from @prefix the node for the longest sequence of components
+ * @path shares with the last path walked, and set *@suffix to the
+ * rest of @path.  This function returns @start if there's no such
+ * sequence.  From now on, @prefix records the components of @path.
+ */
+static Node *resume_prefix(Prefix *prefix, Node *start, const char *path, const char **suffix)
+{
+	size_t length = 0;
+	size_t i;
+
+	if (prefix->path != NULL) {
+		while (prefix->path[length] != '\0' && prefix->path[length] == path[length])
+			length++;
+	}
+
+	/* Both paths have a separator at the end of this component,
+	 * otherwise they would differ before @length.  */
+	for (i = prefix->nb_components; i > 0; i--) {
+		if (prefix->components[i - 1].end < length)
+			break;
+	}
+
+	prefix->path = path;
+	prefix->nb_components = i;
+
+	if (i == 0) {
+		*suffix = path;
+		return start;
+	}
+
+	*suffix = path + prefix->components[i - 1].end;
+	return prefix->components[i - 1].node;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(**(const char ***) a, **(const char ***) b);
+}
+
+/**
+ * Find in @root file-system the nodes for the @nb_paths @paths, as
+ * find_node() would do for each of them with @from and @flags.  The
+ * node for @paths[i] is stored in @nodes[i], or NULL if an error
+ * occurred and @errors[i] is then set to -errno.
+ *
+ * Paths are sorted first, so as the components they share are walked
+ * once, and the tree is locked once for the whole batch.
+ */
+void find_nodes(Node *root, Node *from, const char **paths, size_t nb_paths, int flags,
+		Node **nodes, int *errors)
+{
+	Tree *tree = root->tree;
+	Walk walk = { .root = root };
+	const char ***sorted;
+	size_t generation;
+	Prefix prefix;
+	size_t i;
+
+	/* This is only an optimization.  */
+	sorted = malloc(nb_paths * sizeof(*sorted));
+	if (sorted == NULL) {
+		for (i = 0; i < nb_paths; i++)
+			nodes[i] = find_node(root, from, paths[i], flags, &errors[i]);
+		return;
+	}
+
+	for (i = 0; i < nb_paths; i++)
+		sorted[i] = &paths[i];
+
+	qsort(sorted, nb_paths, sizeof(*sorted), compare_paths);
+
+	drain_watch_events(tree, false);
+
+	prefix.path = NULL;
+	prefix.nb_components = 0;
+	walk.prefix = &prefix;
+
+	read_lock_tree(tree);
+	generation = get_generation(tree);
+
+	for (i = 0; i < nb_paths; ) {
+		size_t index = sorted[i] - paths;
+		const char *path = paths[index];
+		int *error = &errors[index];
+		const char *suffix;
+		LookupKey key;
+		Node *start;
+		Node *node;
+		Fill fill;
+		int status;
+
+		/* Nodes recorded for the previous paths can't be used
+		 * anymore if the tree was modified in the meantime,
+		 * either by a walk or by a fill.  */
+		if (get_generation(tree) != generation) {
+			generation = get_generation(tree);
+			prefix.path = NULL;
+			prefix.nb_components = 0;
+		}
+
+		start = (path[0] == '/' ? root : from);
+
+		node = lookup_cache_get(&key, root, start, path, flags);
+		if (node == NULL) {
+			node = resume_prefix(&prefix, start, path, &suffix);
+
+			walk.unfilled    = NULL;
+			walk.depth       = 0;
+			walk.incomplete  = false;
+			walk.is_volatile = false;
+			node = walk_path(&walk, node, suffix, flags, error, 0);
+		}
+
+		if (node != NULL || *error != -EAGAIN || walk.writable) {
+			if (node != NULL) {
+				if (!walk.is_volatile)
+					lookup_cache_put(&key, node);
+				*error = 0;
+			}
+
+			count_failure(tree, node, *error);
+			nodes[index] = node;
+			walk.unfillable = NULL;
+			i++;
+			continue;
+		}
+
+		/* Something has to be modified in the tree, then this
+		 * path is walked again, as in find_node_().  */
+		if (walk.unfilled == NULL) {
+			read_unlock_tree(tree);
+			walk.writable = true;
+			write_lock_tree(tree);
+		}
+		else {
+			status = start_fill(&fill, walk.unfilled);
+			read_unlock_tree(tree);
+
+			if (status >= 0)
+				status = finish_fill(&fill);
+
+			if (status < 0)
+				walk.unfillable = walk.unfilled;
+
+			read_lock_tree(tree);
+		}
+	}
+
+	if (walk.writable)
+		write_unlock_tree(tree);
+	else
+		read_unlock_tree(tree);
+
+	free(sorted);
+}
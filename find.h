@@ -23,10 +23,15 @@
 #ifndef PROOT_VFS_FIND
 #define PROOT_VFS_FIND
 
+#include <sys/types.h>	/* ssize_t, */
 #include "vfs/node.h"
 
 extern Node *find_node_(Node *root, Node *from, const char *path, int flags,
 			int *error, size_t symlink_count);
+extern void find_nodes(Node *root, Node *from, const char **paths, size_t nb_paths, int flags,
+		Node **nodes, int *errors);
+extern ssize_t translate_path(Node *root, Node *from, const char *path, int flags,
+			char *buffer, size_t size);
 
 static inline Node *find_node(Node *root, Node *from, const char *path,	int flags, int *error)
 {
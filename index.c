@@ -0,0 +1,447 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+
+#include <stdint.h>	/* uint*_t, */
+#include <string.h>	/* str*(3), mem*(3), */
+#include <errno.h>	/* ENOMEM, */
+#include <assert.h>	/* assert(3), */
+#include <talloc.h>
+#ifdef __SSE2__
+#include <emmintrin.h>	/* _mm_*, */
+#endif
+#include "vfs/index.h"
+#include "vfs/node.h"
+#include "vfs/memory.h"
+#include "vfs/component.h"
+#include "vfs/listing.h"
+
+/* Number of children up to which their tags are scanned instead of
+ * probing a table: it fits one SSE2 register.  */
+#define SMALL_INDEX_MAX 16
+
+struct index_slot
+{
+	uint32_t hash;
+
+	/* Position + 1 of the child in the dense array, or 0 if this
+	 * slot is free.  */
+	uint32_t position;
+};
+
+/**
+ * Get the tag of @hash, that is, its most significant byte.
+ */
+static inline uint8_t get_tag(uint32_t hash)
+{
+	return hash >> 24;
+}
+
+/**
+ * Check whether @node is named @name, of @length bytes.
+ */
+static inline bool has_name(const Node *node, const char *name, size_t length)
+{
+	return strncmp(node->name, name, length) == 0 && node->name[length] == '\0';
+}
+
+/**
+ * Check whether the children of @index are stored in the index
+ * itself, in which case it has neither tags nor table.
+ */
+static inline bool is_inline(const ChildIndex *index)
+{
+	return index->nodes == index->inline_nodes;
+}
+
+/**
+ * Get the table of @index, or NULL if it has none.
+ */
+static inline struct index_slot *get_table(const ChildIndex *index)
+{
+	return is_inline(index) ? NULL : index->table;
+}
+
+/**
+ * Get the number of slots of the table of @index, twice the maximum
+ * number of children so as probe sequences remain short.
+ */
+static inline uint32_t get_table_size(const ChildIndex *index)
+{
+	return 2 * index->max_nodes;
+}
+
+/**
+ * Insert in the table of @index the child at @position, with the
+ * given @hash.
+ */
+static void insert_slot(ChildIndex *index, uint32_t hash, uint32_t position)
+{
+	uint32_t mask = get_table_size(index) - 1;
+	uint32_t i;
+
+	for (i = hash & mask; index->table[i].position != 0; i = (i + 1) & mask)
+		;
+
+	index->table[i].hash     = hash;
+	index->table[i].position = position + 1;
+}
+
+/**
+ * Find the slot in the table of @index for the child at @position,
+ * with the given @hash.
+ */
+static uint32_t find_slot(const ChildIndex *index, uint32_t hash, uint32_t position)
+{
+	uint32_t mask = get_table_size(index) - 1;
+	uint32_t i;
+
+	for (i = hash & mask; index->table[i].position != position + 1; i = (i + 1) & mask)
+		assert(index->table[i].position != 0);
+
+	return i;
+}
+
+/**
+ * Free the slot @i in the table of @index, then shift back the slots
+ * of the same probe sequence, so as no tombstones are needed.
+ */
+static void delete_slot(ChildIndex *index, uint32_t i)
+{
+	uint32_t mask = get_table_size(index) - 1;
+	uint32_t j = i;
+
+	while (1) {
+		uint32_t home;
+
+		index->table[i].position = 0;
+
+		do {
+			j = (j + 1) & mask;
+			if (index->table[j].position == 0)
+				return;
+
+			home = index->table[j].hash & mask;
+
+			/* Slot @j stays where it is if its home slot is
+			 * cyclically in (@i, @j].  */
+		} while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+
+		index->table[i] = index->table[j];
+		i = j;
+	}
+}
+
+/**
+ * Get the size of the tags of an index of @max_nodes children: they
+ * are read by chunks of SMALL_INDEX_MAX bytes.
+ */
+static inline size_t get_tags_size(uint32_t max_nodes)
+{
+	return (max_nodes + SMALL_INDEX_MAX - 1) & ~(SMALL_INDEX_MAX - 1);
+}
+
+/**
+ * Estimate the memory used by the arrays of @index.
+ */
+static size_t index_footprint(const ChildIndex *index)
+{
+	if (index->nodes == NULL || is_inline(index))
+		return 0;
+
+	return TALLOC_CHUNK_SIZE(index->max_nodes * sizeof(Node *) + get_tags_size(index->max_nodes))
+		+ (index->table != NULL
+			? TALLOC_CHUNK_SIZE(get_table_size(index) * sizeof(struct index_slot))
+			: 0);
+}
+
+/**
+ * Grow the arrays of @parent's index so as @nb_nodes children fit.
+ * The first children are stored in the index itself, then in a chunk
+ * along with their tags.  The table is created -- or rebuilt -- once
+ * the tags can't be scanned anymore.  This function returns -ENOMEM
+ * if there's not enough memory, otherwise 0.  The tree has to be
+ * write-locked.
+ */
+static int grow_index(Node *parent, size_t nb_nodes)
+{
+	ChildIndex *index = &parent->children;
+	struct index_slot *table = NULL;
+	uint32_t max_nodes;
+	size_t tags_size;
+	uint8_t *tags;
+	Node **nodes;
+	uint32_t i;
+
+	/* The table size has to be a power of two, see
+	 * get_table_size().  */
+	if (nb_nodes > UINT32_MAX / 4)
+		return -ENOMEM;
+
+	if (index->nodes == NULL && nb_nodes <= INLINE_INDEX_MAX) {
+		index->nodes     = index->inline_nodes;
+		index->max_nodes = INLINE_INDEX_MAX;
+		return 0;
+	}
+
+	max_nodes = index->max_nodes == 0 ? 4 : 2 * index->max_nodes;
+	while (max_nodes < nb_nodes)
+		max_nodes *= 2;
+
+	tags_size = get_tags_size(max_nodes);
+
+	nodes = talloc_size(parent, max_nodes * sizeof(Node *) + tags_size);
+	if (nodes == NULL)
+		return -ENOMEM;
+
+	if (max_nodes > SMALL_INDEX_MAX) {
+		table = talloc_zero_size(parent, 2 * max_nodes * sizeof(struct index_slot));
+		if (table == NULL) {
+			talloc_free(nodes);
+			return -ENOMEM;
+		}
+		talloc_set_name_const(table, "$index_table");
+	}
+
+	talloc_set_name_const(nodes, "$index");
+
+	tags = (uint8_t *) (nodes + max_nodes);
+	memset(tags, 0, tags_size);
+
+	/* Inline children have no tags yet.  */
+	for (i = 0; i < index->nb_nodes; i++) {
+		nodes[i] = index->nodes[i];
+		tags[i]  = get_tag(nodes[i]->hash);
+	}
+
+	account_memory(parent->tree, -index_footprint(index));
+
+	if (!is_inline(index)) {
+		TALLOC_FREE(index->nodes);
+		TALLOC_FREE(index->table);
+	}
+
+	index->nodes     = nodes;
+	index->tags      = tags;
+	index->max_nodes = max_nodes;
+	index->table     = table;
+
+	if (table != NULL) {
+		for (i = 0; i < index->nb_nodes; i++)
+			insert_slot(index, index->nodes[i]->hash, i);
+	}
+
+	account_memory(parent->tree, index_footprint(index));
+
+	return 0;
+}
+
+/**
+ * Add @child to the index of @parent's children.  This function
+ * returns -ENOMEM if there's not enough memory, otherwise 0.  The
+ * tree has to be write-locked.
+ */
+int add_to_index(Node *parent, Node *child)
+{
+	ChildIndex *index = &parent->children;
+	uint32_t position;
+	int status;
+
+	if (index->nb_nodes == index->max_nodes) {
+		status = grow_index(parent, index->nb_nodes + 1);
+		if (status < 0)
+			return status;
+	}
+
+	child->hash = hash_name(child->name, strlen(child->name));
+
+	forget_listing(parent);
+
+	position = index->nb_nodes++;
+	index->nodes[position] = child;
+	child->position = position;
+
+	if (is_inline(index))
+		return 0;
+
+	index->tags[position] = get_tag(child->hash);
+
+	if (index->table != NULL)
+		insert_slot(index, child->hash, position);
+
+	return 0;
+}
+
+/**
+ * Grow the index of @parent's children, if needed, so as @nb_children
+ * more children are added without growing it again.  This function
+ * returns -ENOMEM if there's not enough memory, otherwise 0.  The
+ * tree has to be write-locked.
+ */
+int reserve_index(Node *parent, size_t nb_children)
+{
+	ChildIndex *index = &parent->children;
+
+	if (index->nb_nodes + nb_children <= index->max_nodes)
+		return 0;
+
+	return grow_index(parent, index->nb_nodes + nb_children);
+}
+
+/**
+ * Remove @child from the index of @parent's children.  The last child
+ * takes its position, see FOR_EACH_CHILD_SAFE().  The arrays of the
+ * index are freed along with its last child.  The tree has to be
+ * write-locked.
+ */
+void remove_from_index(Node *parent, Node *child)
+{
+	ChildIndex *index = &parent->children;
+	uint32_t position = child->position;
+	uint32_t last = index->nb_nodes - 1;
+	Node *moved;
+
+	assert(index->nodes[position] == child);
+
+	forget_listing(parent);
+
+	if (get_table(index) != NULL)
+		delete_slot(index, find_slot(index, child->hash, position));
+
+	if (position != last) {
+		moved = index->nodes[last];
+
+		if (get_table(index) != NULL)
+			index->table[find_slot(index, moved->hash, last)].position = position + 1;
+
+		index->nodes[position] = moved;
+		moved->position = position;
+
+		if (!is_inline(index))
+			index->tags[position] = index->tags[last];
+	}
+
+	if (!is_inline(index))
+		index->tags[last] = 0;
+
+	index->nb_nodes--;
+
+	if (index->nb_nodes == 0) {
+		account_memory(parent->tree, -index_footprint(index));
+		if (!is_inline(index)) {
+			TALLOC_FREE(index->nodes);
+			TALLOC_FREE(index->table);
+		}
+		index->nodes = NULL;
+		index->tags  = NULL;
+		index->table = NULL;
+		index->max_nodes = 0;
+	}
+}
+
+/**
+ * Find among the children of @index the one named @name, of @length
+ * bytes, by scanning their tags for @tag.
+ */
+static Node *scan_tags(const ChildIndex *index, uint8_t tag, const char *name, size_t length)
+{
+	uint32_t i;
+
+#ifdef __SSE2__
+	uint32_t base;
+
+	for (base = 0; base < index->nb_nodes; base += SMALL_INDEX_MAX) {
+		__m128i tags = _mm_loadu_si128((const __m128i *) (index->tags + base));
+		uint32_t matches = _mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_set1_epi8(tag)));
+
+		while (matches != 0) {
+			i = base + __builtin_ctz(matches);
+			matches &= matches - 1;
+
+			if (i < index->nb_nodes && has_name(index->nodes[i], name, length))
+				return index->nodes[i];
+		}
+	}
+#else
+	for (i = 0; i < index->nb_nodes; i++) {
+		if (index->tags[i] == tag && has_name(index->nodes[i], name, length))
+			return index->nodes[i];
+	}
+#endif
+
+	return NULL;
+}
+
+/**
+ * Get @parent's child named @name, of @length bytes, where @hash is
+ * hash_name(@name, @length), as computed by next_component() for
+ * instance.  This function returns NULL if there's no such child.
+ */
+Node *find_hashed_in_index(const Node *parent, const char *name, size_t length, uint32_t hash)
+{
+	const ChildIndex *index = &parent->children;
+	uint32_t mask;
+	uint32_t i;
+
+	if (index->nb_nodes == 0)
+		return NULL;
+
+	if (is_inline(index)) {
+		for (i = 0; i < index->nb_nodes; i++) {
+			if (index->nodes[i]->hash == hash && has_name(index->nodes[i], name, length))
+				return index->nodes[i];
+		}
+		return NULL;
+	}
+
+	if (index->table == NULL)
+		return scan_tags(index, get_tag(hash), name, length);
+
+	mask = get_table_size(index) - 1;
+	for (i = hash & mask; index->table[i].position != 0; i = (i + 1) & mask) {
+		const Node *child;
+
+		if (index->table[i].hash != hash)
+			continue;
+
+		child = index->nodes[index->table[i].position - 1];
+		if (has_name(child, name, length))
+			return (Node *) child;
+	}
+
+	return NULL;
+}
+
+/**
+ * Get @parent's child named @name, of @length bytes -- computed if
+ * negative.  This function returns NULL if there's no such child.
+ */
+Node *find_in_index(const Node *parent, const char *name, ssize_t length)
+{
+	if (parent->children.nb_nodes == 0)
+		return NULL;
+
+	if (length < 0)
+		length = strlen(name);
+
+	return find_hashed_in_index(parent, name, length, hash_name(name, length));
+}
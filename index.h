@@ -0,0 +1,91 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_INDEX
+#define PROOT_VFS_INDEX
+
+#include <stddef.h>	/* size_t, */
+#include <stdint.h>	/* uint*_t, */
+#include <stdbool.h>	/* bool, */
+#include <sys/types.h>	/* ssize_t, */
+
+struct node;
+struct index_slot;
+
+/* Number of children stored in the index itself.  */
+#define INLINE_INDEX_MAX 2
+
+/* Children of a directory, see vfs/index.c.  */
+typedef struct child_index
+{
+	/* Children, in no particular order: either @inline_nodes or a
+	 * chunk that also holds one byte of the hash of their names.  */
+	struct node **nodes;
+	uint32_t nb_nodes;
+	uint32_t max_nodes;
+
+	union {
+		struct {
+			/* Tags of the children, in the same chunk as
+			 * @nodes.  */
+			uint8_t *tags;
+
+			/* Open-addressing table of the children, only
+			 * once there are too many of them to scan
+			 * their tags.  */
+			struct index_slot *table;
+		};
+
+		/* The first few children, so as directories that
+		 * have no more don't need any chunk.  */
+		struct node *inline_nodes[INLINE_INDEX_MAX];
+	};
+} ChildIndex;
+
+extern int add_to_index(struct node *parent, struct node *child);
+extern int reserve_index(struct node *parent, size_t nb_children);
+extern void remove_from_index(struct node *parent, struct node *child);
+extern struct node *find_in_index(const struct node *parent, const char *name, ssize_t length);
+extern struct node *find_hashed_in_index(const struct node *parent, const char *name,
+					size_t length, uint32_t hash);
+
+/**
+ * Iterate over the children of @parent: @child is set to each of
+ * them.  Children must not be added or removed meanwhile.
+ */
+#define FOR_EACH_CHILD(child, parent)					\
+	for (uint32_t child##_index = 0;				\
+	     child##_index < (parent)->children.nb_nodes		\
+		     && ((child) = (parent)->children.nodes[child##_index], true); \
+	     child##_index++)
+
+/**
+ * Same as FOR_EACH_CHILD(), however @child can be removed from
+ * @parent meanwhile, since children are iterated backward and the
+ * last child replaces the removed one, see remove_from_index().
+ */
+#define FOR_EACH_CHILD_SAFE(child, parent)				\
+	for (uint32_t child##_index = (parent)->children.nb_nodes;	\
+	     child##_index-- > 0					\
+		     && ((child) = (parent)->children.nodes[child##_index], true); )
+
+#endif /* PROOT_VFS_INDEX */
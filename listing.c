@@ -0,0 +1,425 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stddef.h>	/* offsetof, */
+#include <stdlib.h>	/* malloc(3), free(3), qsort(3), */
+#include <stdbool.h>	/* bool, */
+#include <string.h>	/* str*(3), memcpy(3), */
+#include <dirent.h>	/* DT_*, */
+#include <errno.h>	/* E*, */
+#include "vfs/listing.h"
+#include "vfs/node.h"
+#include "vfs/tree.h"
+#include "vfs/children.h"
+#include "vfs/attributes.h"
+#include "vfs/memory.h"
+#include "vfs/watch.h"
+
+/* Offsets -- that is, d_off cookies -- of the entries: "." and ".."
+ * come first, then each child has the hash of its name plus
+ * CHILD_OFFSET.  As opposed to its position among the children of
+ * its parent, it doesn't change when other children are added or
+ * deleted, so listings can be resumed from any offset.  */
+#define DOT_OFFSET	1
+#define DOTDOT_OFFSET	2
+#define CHILD_OFFSET	3
+
+/* Children of a directory in the order of their offsets, so as
+ * listings are resumed with a binary search.  Negative children are
+ * there too, since they might not be negative anymore once listed.
+ * It is built with the tree read-locked, hence it is allocated with
+ * malloc(3) and published atomically, see load_listing().  */
+typedef struct listing
+{
+	size_t nb_children;
+	const Node *children[];
+} Listing;
+
+/**
+ * Get the offset of the entry of @child, see CHILD_OFFSET.
+ */
+static inline uint64_t get_offset(const Node *child)
+{
+	return (uint64_t) child->hash + CHILD_OFFSET;
+}
+
+/**
+ * Get the inode number to report for @node: the one listed by its
+ * parent or stat'ed, otherwise a number derived from its name for
+ * nodes that are not from the actual file-system.
+ */
+static uint64_t get_ino(const Node *node)
+{
+	if (node->ino != 0)
+		return node->ino;
+
+	if (node->attributes_ != NULL && (node->attributes_->statx.stx_mask & STATX_INO) != 0)
+		return node->attributes_->statx.stx_ino;
+
+	return UINT64_C(1) << 63 | node->hash;
+}
+
+/**
+ * Check whether @child can't be found in the actual directory of its
+ * parent: it is bound, or it has children of its own -- as the
+ * intermediate directories of a binding.
+ */
+static inline bool is_virtual(const Node *child)
+{
+	return child->special || child->children.nb_nodes != 0;
+}
+
+/**
+ * Check whether @child is listed by read_children(), where
+ * @virtual_only tells whether the actual directory of its parent is
+ * missing.  Negative children are not, neither are the ones created
+ * by a lookup with O_CREAT -- of unknown type and not listed by
+ * @child's parent -- since they might not exist yet.
+ */
+static bool is_listed(const Node *child, bool virtual_only)
+{
+	if (child->negative)
+		return false;
+
+	if (virtual_only)
+		return is_virtual(child);
+
+	return child->type != DT_UNKNOWN || child->ino != 0 || is_virtual(child);
+}
+
+/**
+ * Get the size of the record for an entry named @name.
+ */
+static inline size_t get_record_size(const char *name)
+{
+	size_t size = offsetof(struct linux_dirent64, d_name) + strlen(name) + 1;
+
+	return (size + 7) & ~(size_t) 7;
+}
+
+/**
+ * Write at @buffer the record of the entry @name, of size
+ * @record_size, see get_record_size().
+ */
+static void write_record(char *buffer, size_t record_size, const char *name, uint64_t ino,
+			int type, uint64_t offset)
+{
+	struct linux_dirent64 *entry = (struct linux_dirent64 *) buffer;
+
+	memset(entry, 0, record_size);
+
+	entry->d_ino    = ino;
+	entry->d_off    = offset;
+	entry->d_reclen = record_size;
+	entry->d_type   = type;
+	strcpy(entry->d_name, name);
+}
+
+/**
+ * Order @a and @b, two children, by offset then by name, see
+ * get_offset().
+ */
+static int compare_children(const void *a, const void *b)
+{
+	const Node *child_a = *(const Node **) a;
+	const Node *child_b = *(const Node **) b;
+
+	if (child_a->hash != child_b->hash)
+		return child_a->hash < child_b->hash ? -1 : 1;
+
+	return strcmp(child_a->name, child_b->name);
+}
+
+/**
+ * Get the size of @listing, as accounted in the memory usage of the
+ * tree.
+ */
+static inline size_t listing_footprint(const Listing *listing)
+{
+	return offsetof(Listing, children) + listing->nb_children * sizeof(Node *);
+}
+
+/**
+ * Get the children of @node, a directory, in the order of their
+ * offsets.  They are sorted once, then until a child is added or
+ * deleted, see forget_listing().  The tree has to be locked, at
+ * least for reading.  This function returns NULL if there's not
+ * enough memory.
+ */
+static const Listing *load_listing(Node *node)
+{
+	Listing *expected = NULL;
+	Listing *listing;
+	const Node *child;
+	size_t i = 0;
+
+	listing = __atomic_load_n(&node->listing_, __ATOMIC_ACQUIRE);
+	if (listing != NULL)
+		return listing;
+
+	listing = malloc(offsetof(Listing, children) + node->children.nb_nodes * sizeof(Node *));
+	if (listing == NULL)
+		return NULL;
+
+	FOR_EACH_CHILD(child, node)
+		listing->children[i++] = child;
+	listing->nb_children = i;
+
+	qsort(listing->children, listing->nb_children, sizeof(Node *), compare_children);
+
+	/* Another thread might have sorted them in the meantime.  */
+	if (!__atomic_compare_exchange_n(&node->listing_, &expected, listing, false,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(listing);
+		return expected;
+	}
+
+	account_memory(node->tree, listing_footprint(listing));
+
+	return listing;
+}
+
+/**
+ * Forget the order of @node's children, as computed by
+ * load_listing().  The tree has to be write-locked.
+ */
+void forget_listing(Node *node)
+{
+	Listing *listing = node->listing_;
+
+	if (listing == NULL)
+		return;
+
+	account_memory(node->tree, -listing_footprint(listing));
+
+	free(listing);
+	node->listing_ = NULL;
+}
+
+/**
+ * Get the position in @listing of the first child whose offset is
+ * greater than @offset.
+ */
+static size_t search_listing(const Listing *listing, uint64_t offset)
+{
+	size_t low = 0;
+	size_t high = listing->nb_children;
+
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+
+		if (get_offset(listing->children[middle]) <= offset)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+/**
+ * Write in @buffer, of @size bytes, the records of the entries of
+ * @node, a directory, that come after *@offset; this latter is then
+ * set to the offset of the last record.  Only the virtual children
+ * are written if @virtual_only, see is_listed().  Children with the
+ * same offset are written all together, or not at all.  The tree has
+ * to be locked, at least for reading.  This function returns
+ * -EINVAL if @buffer is too small for the next record, otherwise the
+ * number of bytes written.
+ */
+static ssize_t write_records(Node *node, uint64_t *offset, char *buffer, size_t size,
+			bool virtual_only)
+{
+	const Listing *listing;
+	size_t used = 0;
+	size_t i;
+
+	if (*offset < DOT_OFFSET) {
+		size_t record_size = get_record_size(".");
+
+		if (record_size > size)
+			return -EINVAL;
+
+		write_record(buffer + used, record_size, ".", get_ino(node), DT_DIR, DOT_OFFSET);
+		used += record_size;
+		*offset = DOT_OFFSET;
+	}
+
+	if (*offset < DOTDOT_OFFSET) {
+		size_t record_size = get_record_size("..");
+
+		if (used + record_size > size)
+			return used > 0 ? (ssize_t) used : -EINVAL;
+
+		write_record(buffer + used, record_size, "..", get_ino(node->parent), DT_DIR,
+			DOTDOT_OFFSET);
+		used += record_size;
+		*offset = DOTDOT_OFFSET;
+	}
+
+	if (node->children.nb_nodes == 0)
+		return used;
+
+	listing = load_listing(node);
+	if (listing == NULL)
+		return used > 0 ? (ssize_t) used : -ENOMEM;
+
+	for (i = search_listing(listing, *offset); i < listing->nb_children; ) {
+		const Node *first = listing->children[i];
+		size_t group_size = 0;
+		size_t end;
+
+		for (end = i; end < listing->nb_children
+			     && listing->children[end]->hash == first->hash; end++) {
+			if (is_listed(listing->children[end], virtual_only))
+				group_size += get_record_size(listing->children[end]->name);
+		}
+
+		if (used + group_size > size) {
+			if (used == 0)
+				return -EINVAL;
+			break;
+		}
+
+		for (; i < end; i++) {
+			const Node *child = listing->children[i];
+			size_t record_size;
+
+			if (!is_listed(child, virtual_only))
+				continue;
+
+			record_size = get_record_size(child->name);
+			write_record(buffer + used, record_size, child->name,
+				get_ino(child), child->type, get_offset(child));
+			used += record_size;
+		}
+
+		/* Unlisted children are skipped for good.  */
+		*offset = get_offset(first);
+	}
+
+	return used;
+}
+
+/**
+ * Check whether @status, as returned by fill_children(), tells that
+ * the actual directory is missing.
+ */
+static inline bool is_missing(ssize_t status)
+{
+	return status == -ENOENT || status == -ENOTDIR;
+}
+
+/**
+ * Check whether @node has children that are not in its actual
+ * directory, see is_virtual().
+ */
+static bool has_virtual_children(const Node *node)
+{
+	const Node *child;
+
+	FOR_EACH_CHILD(child, node) {
+		if (is_listed(child, true))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Check whether the children of @node can be listed as they are.
+ */
+static inline bool is_filled(const Node *node)
+{
+	return node->children_filled && !is_binding_stale(node);
+}
+
+/**
+ * Write in @buffer, of @size bytes, the entries of @node, a
+ * directory, as getdents64(2) would do: these are "." and "..", then
+ * its children -- special ones included -- in the order of their
+ * offsets, that is, their d_off cookies.  The listing is resumed
+ * from *@offset, 0 initially, and this latter is then set to the
+ * offset of the last entry written, so successive calls return all
+ * the entries even if some are added or deleted meanwhile.  @node is
+ * filled first if needed, but once it is no actual directories are
+ * read.  Only its virtual children are listed if its actual
+ * directory is missing.  This function returns -errno if an error
+ * occurred, otherwise the number of bytes written, 0 at the end of
+ * the listing.
+ */
+ssize_t read_children(Node *node, uint64_t *offset, void *buffer, size_t size)
+{
+	Tree *tree = node->tree;
+	bool writable = false;
+	bool virtual_only;
+	ssize_t status = 0;
+
+	if (node->type != DT_DIR)
+		return -ENOTDIR;
+
+	drain_watch_events(tree, false);
+
+	read_lock_tree(tree);
+
+	/* The directory is read without holding the lock, as done
+	 * by lookups.  */
+	if (!is_filled(node)) {
+		read_unlock_tree(tree);
+
+		status = fill_children(node);
+		if (status < 0 && !is_missing(status))
+			return status;
+
+		read_lock_tree(tree);
+	}
+
+	/* It was flushed meanwhile, it is filled with the lock held
+	 * this time.  */
+	if (!is_filled(node) && status >= 0) {
+		read_unlock_tree(tree);
+		write_lock_tree(tree);
+		writable = true;
+
+		status = fill_children(node);
+		if (status < 0 && !is_missing(status))
+			goto end;
+	}
+
+	/* Only the virtual children are listed if the actual
+	 * directory is missing, as for the intermediate directories
+	 * of a binding.  */
+	virtual_only = (status < 0);
+	if (virtual_only && !has_virtual_children(node))
+		goto end;
+
+	touch_directory(node);
+
+	status = write_records(node, offset, buffer, size, virtual_only);
+end:
+	if (writable)
+		write_unlock_tree(tree);
+	else
+		read_unlock_tree(tree);
+
+	return status;
+}
@@ -0,0 +1,33 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_LISTING
+#define PROOT_VFS_LISTING
+
+#include <sys/types.h>	/* ssize_t, */
+#include <stdint.h>	/* uint64_t, */
+#include "vfs/node.h"
+
+extern ssize_t read_children(Node *node, uint64_t *offset, void *buffer, size_t size);
+extern void forget_listing(Node *node);
+
+#endif /* PROOT_VFS_LISTING */
@@ -2,56 +2,65 @@
 #include <stdio.h>	/* *printf(3), stdout, */
 #include <errno.h>	/* ENOMEM, */
 #include <fcntl.h>	/* O_NOFOLLOW, */
+#include <unistd.h>	/* STDOUT_FILENO, */
 #include <talloc.h>
-#include <uthash.h>
 #include "vfs/node.h"
 #include "vfs/path.h"
 #include "vfs/symlink.h"
 #include "vfs/children.h"
 #include "vfs/find.h"
 #include "vfs/tree.h"
+#include "vfs/cache.h"
+#include "vfs/visit.h"
+#include "vfs/stats.h"
 
-static int dive_into_tree(Node *node)
+static int dive_into_node(Node *node, size_t depth, void *data)
 {
-	Node *child;
 	int status;
 
+	(void) depth;
+	(void) data;
+
 	if (get_path(node, ACTUAL_PATH) == NULL)
 		return -ENOMEM;
 
 	if (get_path(node, VIRTUAL_PATH) == NULL)
 		return -ENOMEM;
 
+	if (node->negative)
+		return VISIT_PRUNE;
+
 	if (node->type == DT_LNK) {
 		if (get_symlink(node, &status) == NULL)
-			return status;
+			goto error;
 	}
 
 	if (node->type != DT_DIR)
-		return 0;
+		return VISIT_PRUNE;
 
 	if (!node->children_filled) {
 		status = fill_children(node);
 		if (status < 0)
-			return status;
-	}
-
-	for (child = node->children; child != NULL; child = child->hh.next) {
-		status = dive_into_tree(child);
-		if (status < 0) {
-			fprintf(stderr, "can't dive into: %s (actually %s)\n",
-				get_path(child, VIRTUAL_PATH),
-				get_path(child, ACTUAL_PATH));
-			return status;
-		}
+			goto error;
 	}
 
 	return 0;
+
+error:
+	fprintf(stderr, "can't dive into: %s (actually %s)\n",
+		get_path(node, VIRTUAL_PATH), get_path(node, ACTUAL_PATH));
+	return status;
+}
+
+static int dive_into_tree(Node *node)
+{
+	return visit_tree(node, dive_into_node, NULL, NULL);
 }
 
 int main(void)
 {
 	const char *new_root = "/usr/local/cedric/rootfs/slackware-8.1";
+	LookupCacheStats stats;
 	Node *root;
 	Node *node;
 	Node *node2;
@@ -115,6 +124,12 @@ int main(void)
 	printf("actual  /usr/true: %s\n", get_path(node, ACTUAL_PATH));
 	printf("virtual /usr/true: %s\n\n", get_path(node, VIRTUAL_PATH));
 
+	get_lookup_cache_stats(root, &stats);
+	printf("lookup cache: %zu hits, %zu misses\n\n", stats.hits, stats.misses);
+
+	fflush(stdout);
+	(void) dump_tree_stats(root, STDOUT_FILENO);
+
 	delete_tree(root);
 
 	exit(EXIT_SUCCESS);
@@ -0,0 +1,265 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdbool.h>	/* bool, */
+#include <assert.h>	/* assert(3), */
+#include <talloc.h>
+#include "vfs/memory.h"
+#include "vfs/node.h"
+#include "vfs/tree.h"
+#include "vfs/symlink.h"
+#include "vfs/attributes.h"
+#include "vfs/evaluator.h"
+
+/* Once the budget is exceeded, children are evicted until this
+ * fraction of the budget is available again, so as evictions -- and
+ * the invalidation of the lookup cache they imply -- are not
+ * performed at each lookup.  */
+#define EVICTION_SLACK 8
+
+/**
+ * Estimate the memory used by @node and the strings it caches.
+ */
+size_t node_footprint(const Node *node)
+{
+	return TALLOC_CHUNK_SIZE(sizeof(Node) + strlen(node->name) + 1)
+		+ string_footprint(node->path_.actual)
+		+ string_footprint(node->path_.virtual)
+		+ string_footprint(node->symlink_)
+		+ (node->resolution_ != NULL ? TALLOC_CHUNK_SIZE(sizeof(Resolution)) : 0)
+		+ (node->attributes_ != NULL ? TALLOC_CHUNK_SIZE(sizeof(Attributes)) : 0)
+		+ evaluation_footprint(node->evaluation_);
+}
+
+/**
+ * Add @node, a directory that has children, to the eviction clock of
+ * its tree.  New directories get a second chance, as if they were
+ * looked into already.  The tree has to be write-locked.
+ */
+void track_directory(Node *node)
+{
+	Tree *tree = node->tree;
+	Node **clock;
+
+	assert(is_write_locked(tree));
+
+	if (node->clock_index != 0)
+		return;
+
+	/* Grow the clock by half, as uthash does for its buckets.  */
+	if (tree->memory.nb_directories == tree->memory.max_directories) {
+		size_t max = tree->memory.max_directories + tree->memory.max_directories / 2 + 16;
+
+		clock = talloc_realloc(tree, tree->memory.clock, Node *, max);
+		if (clock == NULL)
+			return; /* This directory is never evicted.  */
+
+		tree->memory.clock = clock;
+		tree->memory.max_directories = max;
+	}
+
+	tree->memory.clock[tree->memory.nb_directories++] = node;
+	node->clock_index = tree->memory.nb_directories;
+	node->accessed = true;
+}
+
+/**
+ * Remove @node from the eviction clock of its tree, if it is there.
+ * The tree has to be write-locked.
+ */
+void untrack_directory(Node *node)
+{
+	Tree *tree = node->tree;
+	Node *last;
+
+	assert(is_write_locked(tree));
+
+	if (node->clock_index == 0)
+		return;
+
+	last = tree->memory.clock[--tree->memory.nb_directories];
+	tree->memory.clock[node->clock_index - 1] = last;
+	last->clock_index = node->clock_index;
+
+	node->clock_index = 0;
+}
+
+/**
+ * Delete @directory's children that are neither special, referenced
+ * elsewhere, @keep, nor directories with children themselves: these
+ * are evicted later, when the clock points to them.  This function
+ * returns the number of deleted nodes.
+ */
+static size_t evict_directory(Node *directory, const Node *keep)
+{
+	size_t nb_evicted_nodes = 0;
+	Node *child;
+
+	FOR_EACH_CHILD_SAFE(child, directory) {
+		if (   child == keep
+		    || child->special
+		    || child->children.nb_nodes != 0
+		    || talloc_reference_count(child) > 1)
+			continue;
+
+		delete_node(child);
+		nb_evicted_nodes++;
+	}
+
+	if (nb_evicted_nodes > 0)
+		directory->children_filled = false;
+
+	return nb_evicted_nodes;
+}
+
+/**
+ * Delete the paths and the symlink cached in @directory, unless it is
+ * special, referenced elsewhere, or @keep: these are computed again
+ * when needed, see get_path() and get_symlink().
+ */
+static void evict_strings(Node *directory, const Node *keep)
+{
+	if (   directory == keep
+	    || directory->special
+	    || talloc_reference_count(directory) > 1)
+		return;
+
+	account_memory(directory->tree, -string_footprint(directory->path_.actual));
+	TALLOC_FREE(directory->path_.actual);
+
+	account_memory(directory->tree, -string_footprint(directory->path_.virtual));
+	TALLOC_FREE(directory->path_.virtual);
+
+	account_memory(directory->tree, -string_footprint(directory->symlink_));
+	TALLOC_FREE(directory->symlink_);
+}
+
+/**
+ * Evict the children of the least recently used directories of
+ * @tree, as approximated by a CLOCK algorithm, and the strings these
+ * directories cache, until its memory usage is back under its
+ * budget.  @keep, typically the node the caller
+ * goes on with, is never evicted.  The tree has to be write-locked.
+ * This function returns the number of evicted nodes.
+ */
+size_t evict_children(Tree *tree, const Node *keep)
+{
+	size_t nb_evicted_nodes = 0;
+	size_t nb_steps;
+	size_t target;
+
+	assert(is_write_locked(tree));
+
+	if (tree->memory.budget == 0)
+		return 0;
+
+	target = tree->memory.budget - tree->memory.budget / EVICTION_SLACK;
+
+	/* Two turns are enough to clear all the "accessed" bits then
+	 * evict every directory once.  Directories emptied during
+	 * this call are evicted during the next ones.  */
+	nb_steps = 2 * tree->memory.nb_directories;
+
+	while (   tree->memory.usage > target
+	       && tree->memory.nb_directories > 0
+	       && nb_steps-- > 0) {
+		Node *directory;
+
+		if (tree->memory.hand >= tree->memory.nb_directories)
+			tree->memory.hand = 0;
+
+		directory = tree->memory.clock[tree->memory.hand];
+
+		if (directory->accessed) {
+			directory->accessed = false;
+			tree->memory.hand++;
+			continue;
+		}
+
+		nb_evicted_nodes += evict_directory(directory, keep);
+		evict_strings(directory, keep);
+
+		/* Otherwise the last directory was moved at the
+		 * position of this one, see untrack_directory().  */
+		if (directory->clock_index != 0)
+			tree->memory.hand++;
+	}
+
+	if (nb_evicted_nodes > 0)
+		bump_generation(keep);
+
+	return nb_evicted_nodes;
+}
+
+/**
+ * Set the memory budget of @node's tree to @budget bytes, or remove
+ * it if @budget is 0.  Lookups never evict anything by themselves:
+ * children of the least recently used directories are evicted only
+ * here and by shrink_tree(), with the same caveats, once this budget
+ * is exceeded.  This function returns the number of nodes evicted
+ * right away.
+ */
+size_t set_memory_budget(Node *node, size_t budget)
+{
+	size_t nb_evicted_nodes;
+
+	write_lock_tree(node->tree);
+
+	node->tree->memory.budget = budget;
+	nb_evicted_nodes = evict_children(node->tree, node);
+
+	write_unlock_tree(node->tree);
+
+	return nb_evicted_nodes;
+}
+
+/**
+ * Evict children of the least recently used directories of @node's
+ * tree, except @node, if the memory usage of this tree exceeds its
+ * budget.  Note that, as for flush_children(), nodes that are neither
+ * special nor referenced with talloc_reference() are freed: this
+ * function must not be called while other threads might still use
+ * such nodes, typically a node returned by find_node() without the
+ * tree locked.  This function returns the number of evicted nodes.
+ */
+size_t shrink_tree(Node *node)
+{
+	size_t nb_evicted_nodes;
+
+	if (!is_over_budget(node->tree))
+		return 0;
+
+	write_lock_tree(node->tree);
+	nb_evicted_nodes = evict_children(node->tree, node);
+	write_unlock_tree(node->tree);
+
+	return nb_evicted_nodes;
+}
+
+/**
+ * Get the estimated memory used by the nodes of @node's tree and the
+ * strings they cache.
+ */
+size_t get_memory_usage(const Node *node)
+{
+	return __atomic_load_n(&node->tree->memory.usage, __ATOMIC_RELAXED);
+}
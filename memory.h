@@ -0,0 +1,83 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_MEMORY
+#define PROOT_VFS_MEMORY
+
+#include <stddef.h>	/* size_t, */
+#include <string.h>	/* strlen(3), */
+#include <sys/types.h>	/* ssize_t, */
+#include "vfs/node.h"
+#include "vfs/tree.h"
+
+/* Estimation of the memory used by a talloc chunk of @size bytes, as
+ * of talloc 2.x on 64-bit systems.  */
+#define TALLOC_CHUNK_SIZE(size) (96 + (((size) + 15) & ~15))
+
+extern size_t set_memory_budget(Node *node, size_t budget);
+extern size_t shrink_tree(Node *node);
+extern size_t get_memory_usage(const Node *node);
+extern size_t node_footprint(const Node *node);
+extern void track_directory(Node *node);
+extern void untrack_directory(Node *node);
+extern size_t evict_children(Tree *tree, const Node *keep);
+
+/**
+ * Estimate the memory used by @string, a talloc chunk.
+ */
+static inline size_t string_footprint(const char *string)
+{
+	return string != NULL ? TALLOC_CHUNK_SIZE(strlen(string) + 1) : 0;
+}
+
+/**
+ * Add @size bytes, possibly negative, to the memory usage of @tree.
+ * The tree has to be write-locked.
+ */
+static inline void account_memory(Tree *tree, ssize_t size)
+{
+	__atomic_add_fetch(&tree->memory.usage, (size_t) size, __ATOMIC_RELAXED);
+}
+
+/**
+ * Check whether the memory usage of @tree exceeds its budget, if
+ * any.  The tree doesn't have to be locked.
+ */
+static inline bool is_over_budget(const Tree *tree)
+{
+	size_t budget = __atomic_load_n(&tree->memory.budget, __ATOMIC_RELAXED);
+
+	return budget != 0 && __atomic_load_n(&tree->memory.usage, __ATOMIC_RELAXED) > budget;
+}
+
+/**
+ * Record that @node, a directory, was looked into, so as its
+ * children are not evicted soon.  The tree has to be locked, at
+ * least for reading.
+ */
+static inline void touch_directory(Node *node)
+{
+	if (!__atomic_load_n(&node->accessed, __ATOMIC_RELAXED))
+		__atomic_store_n(&node->accessed, true, __ATOMIC_RELAXED);
+}
+
+#endif /* PROOT_VFS_MEMORY */
@@ -20,41 +20,65 @@
  * 02110-1301 USA.
  */
 
-#include <string.h>	/* strlen(3), */
+#include <string.h>	/* strlen(3), mem*(3), */
+#include <assert.h>	/* assert(3), */
 #include <talloc.h>
-#include <uthash.h>
 #include "vfs/node.h"
+#include "vfs/tree.h"
+#include "vfs/memory.h"
+#include "vfs/watch.h"
+#include "vfs/descriptor.h"
+#include "vfs/stats.h"
+#include "vfs/binding.h"
+#include "vfs/listing.h"
 
 /**
  * Add @child to @node's children list, and set @child's parent to
- * @node.
+ * @node.  This function returns -ENOMEM if there's not enough
+ * memory, otherwise 0.  The tree has to be write-locked.
  */
-static void add_child(Node *node, Node *child)
+static int add_child(Node *node, Node *child)
 {
-	HASH_ADD_KEYPTR(hh, node->children, child->name, talloc_get_size(child->name) - 1, child);
+	int status;
+
 	child->parent = node;
+	child->tree   = node->tree;
+	child->binding_epoch = node->tree->binding_epoch;
+
+	status = add_to_index(node, child);
+	if (status < 0)
+		return status;
+
+	account_memory(node->tree, node_footprint(child));
+	count_stat(node->tree, STAT_NODES, 1);
+	track_directory(node);
+
+	return 0;
 }
 
 /**
- * Allocate for @context a new node with given @name and @type.  This
- * function returns NULL if there's not enough memory.
+ * Allocate for @context a new node with given @name and @type, it
+ * is not part of any tree yet.  This function returns NULL if
+ * there's not enough memory.
  */
-Node *new_node(TALLOC_CTX *context, const char *name, ssize_t length, int type)
+static Node *alloc_node(TALLOC_CTX *context, const char *name, ssize_t length, int type)
 {
 	Node *node;
 
-	node = talloc_zero(context, Node);
-	if (node == NULL)
-		return NULL;
-
 	if (length < 0)
 		length = strlen(name);
 
-	node->name = talloc_strndup(node, name, length);
-	if (node->name == NULL)
+	/* The name is stored inline, this saves one talloc chunk per
+	 * node.  */
+	node = talloc_size(context, sizeof(Node) + length + 1);
+	if (node == NULL)
 		return NULL;
 
-	talloc_set_name_const(node->name, "$name");
+	talloc_set_name_const(node, "Node");
+
+	memset(node, 0, sizeof(Node));
+	memcpy(node->name, name, length);
+	node->name[length] = '\0';
 
 	node->type   = type;
 	node->parent = node;
@@ -62,6 +86,31 @@ Node *new_node(TALLOC_CTX *context, const char *name, ssize_t length, int type)
 	return node;
 }
 
+/**
+ * Allocate for @context a new node with given @name and @type, this
+ * node is the root of a new tree.  This function returns NULL if
+ * there's not enough memory.
+ */
+Node *new_node(TALLOC_CTX *context, const char *name, ssize_t length, int type)
+{
+	Node *node;
+
+	node = alloc_node(context, name, length, type);
+	if (node == NULL)
+		return NULL;
+
+	node->tree = talloc_zero(node, Tree);
+	if (node->tree == NULL || init_tree(node->tree) < 0) {
+		TALLOC_FREE(node);
+		return NULL;
+	}
+
+	talloc_set_name_const(node->tree, "$tree");
+	node->binding_epoch = node->tree->binding_epoch;
+
+	return node;
+}
+
 /**
  * Allocate a new node with given @name and @type, then add it to
  * @node's children list, and set its parent to @node.  This function
@@ -71,11 +120,64 @@ Node *add_new_child(Node *node, const char *name, ssize_t length, int type)
 {
 	Node *child;
 
-	child = new_node(node, name, length, type);
-	if (child == NULL)
-		return NULL;
+	write_lock_tree(node->tree);
+
+	child = alloc_node(node, name, length, type);
+	if (child != NULL && add_child(node, child) < 0)
+		TALLOC_FREE(child);
+
+	write_unlock_tree(node->tree);
+
+	return child;
+}
+
+/**
+ * Same as add_new_child(), except memory is carved from @pool, as
+ * returned by talloc_pool().  This memory is given back only once
+ * @pool and all the nodes carved from it are freed.
+ */
+Node *add_new_child_from_pool(TALLOC_CTX *pool, Node *node, const char *name,
+			ssize_t length, int type)
+{
+	Node *child;
 
-	add_child(node, child);
+	write_lock_tree(node->tree);
+
+	child = alloc_node(pool, name, length, type);
+	if (child != NULL) {
+		(void) talloc_steal(node, child);
+		if (add_child(node, child) < 0)
+			TALLOC_FREE(child);
+	}
+
+	write_unlock_tree(node->tree);
 
 	return child;
 }
+
+/**
+ * Remove @node from its parent's children list, then free it.  @node
+ * must not have children anymore.  The tree has to be write-locked.
+ */
+void delete_node(Node *node)
+{
+	Node *parent = node->parent;
+
+	assert(is_write_locked(node->tree));
+	assert(node->children.nb_nodes == 0);
+
+	remove_from_index(parent, node);
+
+	untrack_directory(node);
+	if (parent->children.nb_nodes == 0)
+		untrack_directory(parent);
+
+	unregister_watch(node);
+	drop_descriptor(node);
+	unindex_binding(node);
+	forget_listing(node);
+
+	account_memory(node->tree, -node_footprint(node));
+	count_stat(node->tree, STAT_NODES, -1);
+	TALLOC_FREE(node);
+}
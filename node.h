@@ -25,7 +25,15 @@
 
 #include <stdbool.h>	/* bool, */
 #include <talloc.h>	/* TALLOC_CTX, */
-#include <uthash.h>	/* UT_hash_handle, */
+#include <stdint.h>	/* uint32_t, */
+#include "vfs/index.h"
+
+struct tree;
+struct resolution;
+struct attributes;
+struct evaluator;
+struct evaluation;
+struct listing;
 
 typedef struct node
 {
@@ -33,16 +41,14 @@ typedef struct node
 	 * General info.: shouldn't be written outside vfs/                   *
 	 **********************************************************************/
 
-	/* Short name of this node.  */
-	const char *name;
+	/* A node is part of a tree.  */
+	struct node *parent;
+	ChildIndex children;
+	struct tree *tree;
 
 	/* Node type, as in linux_dirent->d_type.  */
 	int type;
 
-	/* A node is part of a tree.  */
-	struct node *parent;
-	struct node *children;
-
 
 	/**********************************************************************
 	 * General info.: can be written outside vfs/, with care.             *
@@ -63,8 +69,48 @@ typedef struct node
 	/* Whether "regular" children were created.  */
 	bool children_filled;
 
-	/* Make this structure hashable, key is self->name.  */
-	UT_hash_handle hh;
+	/* Whether this node is a cached non-existent entry, as created
+	 * by lookup_child().  */
+	bool negative;
+
+	/* Whether the evaluators of the tree were matched against this
+	 * node, see attach_evaluator().  */
+	bool evaluator_checked;
+
+	/* Evaluator of the tree matching this node, or NULL, see
+	 * register_evaluator().  */
+	const struct evaluator *attached_evaluator;
+
+	/* Whether this directory was looked into since the last turn
+	 * of the eviction clock, see evict_children().  */
+	bool accessed;
+
+	/* Position + 1 of this directory in the eviction clock of its
+	 * tree, or 0 if it isn't there, see track_directory().  */
+	unsigned int clock_index;
+
+	/* Position + 1 of this directory in the descriptor pool of its
+	 * tree, or 0 if it isn't there, see acquire_directory().  */
+	unsigned int descriptor_index;
+
+	/* Hash of self->name, and position of this node among the
+	 * children of its parent, see add_to_index().  */
+	uint32_t hash;
+	uint32_t position;
+
+	/* Binding epoch of the tree when the actual path of this node
+	 * was last checked, or 0 if this path was changed since its
+	 * children were filled, see revalidate_node().  */
+	uint32_t binding_epoch;
+
+	/* Binding epoch started when this node was last bound or
+	 * unbound, or 0 if never: only the nodes below it have to be
+	 * checked again, see is_binding_stale().  */
+	uint32_t bound_epoch;
+
+	/* Inode number of the actual file as listed by its parent,
+	 * or 0 if unknown, see read_children().  */
+	uint64_t ino;
 
 
 	/**********************************************************************
@@ -79,9 +125,37 @@ typedef struct node
 
 	/* Symbolic link content, when self->type == DT_LNK.  */
 	char *symlink_;
+
+	/* Memoized resolution of this symbolic link, see
+	 * load_resolution().  */
+	struct resolution *resolution_;
+
+	/* Attributes of the actual file, as returned by statx(2), see
+	 * get_attributes().  */
+	struct attributes *attributes_;
+
+	/* Cached result of self->attached_evaluator, see
+	 * evaluate_node().  */
+	struct evaluation *evaluation_;
+
+	/* Children of this directory in the order of their offsets,
+	 * see read_children().  */
+	struct listing *listing_;
+
+
+	/**********************************************************************
+	 * General info.: shouldn't be written outside vfs/                   *
+	 **********************************************************************/
+
+	/* Short name of this node, it is stored inline with the node
+	 * itself, hence it has to be the last field.  */
+	char name[];
 } Node;
 
 extern Node *new_node(TALLOC_CTX *context, const char *name, ssize_t length, int type);
 extern Node *add_new_child(Node *node, const char *name, ssize_t length, int type);
+extern Node *add_new_child_from_pool(TALLOC_CTX *pool, Node *node, const char *name,
+				ssize_t length, int type);
+extern void delete_node(Node *node);
 
 #endif /* PROOT_VFS_NODE */
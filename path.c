@@ -20,121 +20,234 @@
  * 02110-1301 USA.
  */
 
-#include <string.h>	/* strc*(), */
+#include <string.h>	/* str*(3), memcpy(3), */
+#include <limits.h>	/* PATH_MAX, */
 #include <assert.h>	/* assert(0), */
-#include <errno.h>	/* ENOMEM, */
+#include <errno.h>	/* ENOMEM, ERANGE, */
 #include <talloc.h>
 #include "vfs/path.h"
 #include "vfs/node.h"
 #include "vfs/children.h"
+#include "vfs/tree.h"
+#include "vfs/memory.h"
+#include "vfs/descriptor.h"
+#include "vfs/attributes.h"
+#include "vfs/visit.h"
+#include "vfs/watch.h"
+#include "vfs/binding.h"
+#include "vfs/stats.h"
 
 /**
- * Allocate for @context a new @class path built from @node.  This
- * function returns NULL if there's not enough memory.
+ * Get the address of @node->path_.@class.
  */
-static char *new_path_from_node(TALLOC_CTX *context, const Node *node, PathClass class)
+static inline char **get_path_slot(const Node *node, PathClass class)
 {
-	char *path = NULL;
-	size_t size;
+	switch (class) {
+	case ACTUAL_PATH:
+		return (char **) &node->path_.actual;
 
-	size = 0;
-	while (1) {
-		char *old_path = path;
-		const char *prefix;
+	case VIRTUAL_PATH:
+		return (char **) &node->path_.virtual;
 
-		switch (class) {
-		case ACTUAL_PATH:
-			prefix = node->path_.actual ?: node->name;
-			break;
+	default:
+		assert(0);
+	}
+}
+
+/**
+ * Get the @class path already computed for @node, if any.  The
+ * actual path of a node that is not special is ignored if it was
+ * computed before the last change of a binding.
+ */
+static inline const char *get_cached_path(const Node *node, PathClass class)
+{
+	if (class == ACTUAL_PATH && !node->special && is_binding_stale(node))
+		return NULL;
+
+	return __atomic_load_n(get_path_slot(node, class), __ATOMIC_ACQUIRE);
+}
 
-		case VIRTUAL_PATH:
-			prefix = node->path_.virtual ?: node->name;
+/**
+ * Compute the length of the @class path of @node.  This path is made
+ * of the names of @node and its ancestors, up to the nearest one
+ * that either has a @class path already computed or is a root; this
+ * latter is returned in *@top.
+ */
+static size_t measure_path(const Node *node, PathClass class, const Node **top)
+{
+	const char *prefix;
+	size_t length = 0;
+
+	while (1) {
+		prefix = get_cached_path(node, class);
+		if (prefix != NULL || node->parent == node)
 			break;
 
-		default:
-			assert(0);
-		}
+		length += strlen(node->name) + 1;
+		node = node->parent;
+	}
 
-		size += talloc_get_size(prefix);
+	if (prefix == NULL)
+		prefix = node->name;
 
-		path = talloc_size(context, size);
-		if (path == NULL) {
-			TALLOC_FREE(old_path);
-			return NULL;
-		}
+	/* The separator is already provided by the "/" prefix.  */
+	if (length > 0 && strcmp(prefix, "/") == 0)
+		length--;
 
-		strcpy(path, prefix);
+	*top = node;
+	return length + strlen(prefix);
+}
 
-		if (old_path != NULL) {
-			if (strcmp(prefix, "/") != 0)
-				strcat(path, "/");
-			strcat(path, old_path);
-			TALLOC_FREE(old_path);
-		}
+/**
+ * Write in @path the @class path of @node, as measured by
+ * measure_path(): @path is @length + 1 bytes long, and @top is the
+ * nearest ancestor with a @class path.  Components are written from
+ * the end, so each byte is copied only once.
+ */
+static void fill_path(char *path, size_t length, const Node *node, PathClass class, const Node *top)
+{
+	const char *prefix;
+	char *cursor;
 
-		if (prefix != node->name || node->parent == node)
-			break;
+	cursor = path + length;
+	*cursor = '\0';
 
-		node = node->parent;
+	for (; node != top; node = node->parent) {
+		size_t size = strlen(node->name);
+
+		cursor -= size;
+		memcpy(cursor, node->name, size);
+
+		*--cursor = '/';
 	}
 
-	talloc_set_name_const(path, path);
+	/* The separator written last is the prefix itself when this
+	 * latter is "/".  */
+	if (cursor == path)
+		return;
 
-	return path;
+	prefix = get_cached_path(top, class) ?: top->name;
+	memcpy(path, prefix, cursor - path);
 }
 
 /**
- * Get @node->path_.@class, however this function is similar to
- * new_path_from_node(@node, @node, @class) if it was not computed
- * yet.
+ * Allocate for @context a new @class path built from @node.  This
+ * function returns NULL if there's not enough memory.
  */
-const char *get_path(Node *node, PathClass class)
+static char *new_path_from_node(TALLOC_CTX *context, const Node *node, PathClass class)
 {
-	switch (class) {
-	case ACTUAL_PATH:
-		if (node->path_.actual != NULL)
-			return node->path_.actual;
+	const Node *top;
+	size_t length;
+	char *path;
 
-		node->path_.actual = new_path_from_node(node, node, class);
-		if (node->path_.actual == NULL)
-			return NULL;
+	length = measure_path(node, class, &top);
 
-		talloc_set_name_const(node->path_.actual, "$path.actual");
+	path = talloc_size(context, length + 1);
+	if (path == NULL)
+		return NULL;
 
-		return node->path_.actual;
+	fill_path(path, length, node, class, top);
 
-	case VIRTUAL_PATH:
-		if (node->path_.virtual != NULL)
-			return node->path_.virtual;
+	talloc_set_name_const(path, path);
 
-		node->path_.virtual = new_path_from_node(node, node, class);
-		if (node->path_.virtual == NULL)
-			return NULL;
+	return path;
+}
 
-		talloc_set_name_const(node->path_.virtual, "$path.virtual");
+/**
+ * Write in @buffer, of @size bytes, the @class path of @node.  As
+ * opposed to get_path(), nothing is allocated nor cached in @node.
+ * This function returns -ERANGE if @buffer is too small, otherwise
+ * the length of the path.
+ */
+ssize_t render_path(const Node *node, PathClass class, char *buffer, size_t size)
+{
+	const char *path;
+	const Node *top;
+	size_t length;
+
+	path = get_cached_path(node, class);
+	if (path != NULL) {
+		length = strlen(path);
+		if (length >= size)
+			return -ERANGE;
+
+		memcpy(buffer, path, length + 1);
+		return length;
+	}
 
-		return node->path_.virtual;
+	length = measure_path(node, class, &top);
+	if (length >= size)
+		return -ERANGE;
 
-	default:
-		assert(0);
+	fill_path(buffer, length, node, class, top);
+
+	return length;
+}
+
+/**
+ * Get @node->path_.@class, however this function is similar to
+ * new_path_from_node(@node, @node, @class) if it was not computed
+ * yet.  Once computed, this path is read without locking the tree.
+ */
+const char *get_path(Node *node, PathClass class)
+{
+	char **slot = get_path_slot(node, class);
+	const char *cached_path;
+	uint64_t start;
+	char *path;
+
+	cached_path = get_cached_path(node, class);
+	if (cached_path != NULL)
+		return cached_path;
+
+	start = start_latency();
+
+	write_lock_tree(node->tree);
+
+	/* The previous actual path tells whether the children of
+	 * @node are still valid.  */
+	if (class == ACTUAL_PATH)
+		(void) revalidate_node(node);
+
+	path = *slot;
+	if (path == NULL) {
+		path = new_path_from_node(node, node, class);
+		if (path != NULL) {
+			talloc_set_name_const(path, class == ACTUAL_PATH
+					? "$path.actual" : "$path.virtual");
+			account_memory(node->tree, string_footprint(path));
+			__atomic_store_n(slot, path, __ATOMIC_RELEASE);
+		}
 	}
+
+	record_latency(node->tree, LATENCY_GET_PATH, start);
+	write_unlock_tree(node->tree);
+
+	return path;
 }
 
 /**
- * Delete @node->path_.@class if @node is not special, then perform
- * recursively the same for @node's children.
+ * Delete @node->path_.@class if @node is not special, where @data
+ * points to @class, see flush_path().
  */
-void flush_path(Node *node, PathClass class)
+static int flush_node_path(Node *node, size_t depth, void *data)
 {
-	Node *child;
+	PathClass class = *(PathClass *) data;
+
+	(void) depth;
 
 	switch (class) {
 	case ACTUAL_PATH:
-		if (!node->special)
+		if (!node->special) {
+			account_memory(node->tree, -string_footprint(node->path_.actual));
 			TALLOC_FREE(node->path_.actual);
+		}
+		drop_descriptor(node);
+		flush_attributes(node);
 		break;
 
 	case VIRTUAL_PATH:
+		account_memory(node->tree, -string_footprint(node->path_.virtual));
 		TALLOC_FREE(node->path_.virtual);
 		break;
 
@@ -142,32 +255,195 @@ void flush_path(Node *node, PathClass class)
 		assert(0);
 	}
 
-	/* No child deletion, so no need for HASH_ITER.  */
-	for (child = node->children; child != NULL; child = child->hh.next)
-		flush_path(child, class);
+	return 0;
+}
+
+/**
+ * Delete @node->path_.@class if @node is not special, then perform
+ * the same for all @node's descendants.
+ */
+void flush_path(Node *node, PathClass class)
+{
+	write_lock_tree(node->tree);
+
+	(void) visit_tree(node, flush_node_path, NULL, &class);
+
+	write_unlock_tree(node->tree);
+}
+
+/**
+ * Check whether the actual path of @node has changed since the last
+ * binding epoch @node was checked in.  The tree has to be locked, at
+ * least for reading.
+ */
+static bool has_moved(const Node *node)
+{
+	char path[PATH_MAX];
+	const char *previous;
+
+	if (node->binding_epoch == 0)
+		return true;
+
+	if (node->special || !is_binding_stale(node))
+		return false;
+
+	previous = node->path_.actual;
+	if (previous == NULL)
+		return true;
+
+	return (render_path(node, ACTUAL_PATH, path, sizeof(path)) < 0
+		|| strcmp(previous, path) != 0);
+}
+
+/**
+ * Delete everything @node got from its previous actual path, except
+ * its children, see revalidate_node().
+ */
+static void forget_actual_path(Node *node)
+{
+	if (!node->special) {
+		account_memory(node->tree, -string_footprint(node->path_.actual));
+		TALLOC_FREE(node->path_.actual);
+	}
+
+	account_memory(node->tree, -string_footprint(node->symlink_));
+	TALLOC_FREE(node->symlink_);
+
+	unregister_watch(node);
+	drop_descriptor(node);
+	flush_attributes(node);
+}
+
+/**
+ * Flush everything @node got from its actual path if this latter has
+ * changed since the last binding epoch @node was checked in, see
+ * set_actual_path().  Only the children of @node are flushed, the
+ * other descendants are checked in turn once walked, and the bound
+ * ones are kept.  The tree has
+ * to be write-locked.  This function returns -errno if an error
+ * occurred, otherwise 0.
+ */
+int revalidate_node(Node *node)
+{
+	assert(is_write_locked(node->tree));
+
+	if (!is_binding_stale(node))
+		return 0;
+
+	if (has_moved(node)) {
+		count_stat(node->tree, STAT_REVALIDATIONS, 1);
+
+		forget_actual_path(node);
+
+		if (node->children_filled || node->children.nb_nodes != 0)
+			(void) flush_unbound_children(node);
+	}
+
+	__atomic_store_n(&node->binding_epoch, node->tree->binding_epoch, __ATOMIC_RELAXED);
+
+	return 0;
 }
 
 /**
- * Flush everything that depends on @node->path_.actual, then mark
- * @node as special and set @node->path_.actual to a copy of @path.
- * There is no set_virtual_path() since it makes no sense to force the
- * value of @node->path_.virtual.  This function returns -errno if an
- * error occurred, otherwise 0.
+ * Replace the actual path of @node with @path, or with the one
+ * computed from its parent if @path is NULL, then start a new
+ * binding epoch.  The subtree of @node is not walked: each node is
+ * checked once walked again, see revalidate_node(), so as caches of
+ * actual directories that are still reachable are kept.  @binding
+ * is the entry of @node in the reverse index of its tree if @path is
+ * not NULL, see index_binding().  The tree has to be write-locked.
+ */
+static void rebind_node(Node *node, char *path, struct binding *binding)
+{
+	char previous[PATH_MAX];
+	char current[PATH_MAX];
+	Tree *tree = node->tree;
+	uint32_t epoch;
+	bool moved;
+
+	/* Nothing is flushed yet if @node was not checked since the
+	 * previous epoch, it is simply marked as moved.  */
+	moved = has_moved(node);
+
+	if (render_path(node, ACTUAL_PATH, previous, sizeof(previous)) < 0)
+		moved = true;
+
+	unindex_binding(node);
+
+	account_memory(tree, -string_footprint(node->path_.actual));
+	TALLOC_FREE(node->path_.actual);
+
+	if (path != NULL) {
+		account_memory(tree, string_footprint(path));
+		__atomic_store_n(&node->path_.actual, path, __ATOMIC_RELEASE);
+	}
+	node->special = (path != NULL);
+
+	if (path != NULL)
+		index_binding(node, binding);
+
+	if (!moved)
+		moved = (render_path(node, ACTUAL_PATH, current, sizeof(current)) < 0
+			|| strcmp(previous, current) != 0);
+
+	if (moved)
+		forget_actual_path(node);
+
+	epoch = tree->binding_epoch + 1;
+	if (epoch == 0)
+		epoch = 1;
+
+	__atomic_store_n(&node->binding_epoch, moved ? 0 : epoch, __ATOMIC_RELAXED);
+	__atomic_store_n(&node->bound_epoch, epoch, __ATOMIC_RELAXED);
+	__atomic_store_n(&tree->binding_epoch, epoch, __ATOMIC_RELEASE);
+
+	bump_generation(node);
+	count_stat(tree, STAT_REBINDINGS, 1);
+}
+
+/**
+ * Mark @node as special and set @node->path_.actual to a copy of
+ * @path, that is, bind @node to @path.  Actual paths of descendants
+ * are computed relatively to the nearest bound ancestor, and
+ * anything they got from a previous path is flushed lazily, see
+ * rebind_node().  There is no set_virtual_path() since it makes no
+ * sense to force the value of @node->path_.virtual.  This function
+ * returns -errno if an error occurred, otherwise 0.
  */
 int set_actual_path(Node *node, const char *path)
 {
+	struct binding *binding;
 	char *copy_path;
 
+	write_lock_tree(node->tree);
+
 	copy_path = talloc_strdup(node, path);
-	if (copy_path == NULL)
+	binding = new_binding(node);
+	if (copy_path == NULL || binding == NULL) {
+		talloc_free(copy_path);
+		talloc_free(binding);
+		write_unlock_tree(node->tree);
 		return -ENOMEM;
+	}
 
-	flush_children(node, false);
-
-	flush_path(node, ACTUAL_PATH);
+	rebind_node(node, copy_path, binding);
 
-	node->path_.actual = copy_path;
-	node->special = true;
+	write_unlock_tree(node->tree);
 
 	return 0;
 }
+
+/**
+ * Remove the binding of @node, as set by set_actual_path(): its
+ * actual path is computed from its parent again.  Nothing is done
+ * for a root since its actual path can't be computed.
+ */
+void reset_actual_path(Node *node)
+{
+	write_lock_tree(node->tree);
+
+	if (node->special && node->parent != node)
+		rebind_node(node, NULL, NULL);
+
+	write_unlock_tree(node->tree);
+}
@@ -31,7 +31,10 @@ typedef enum {
 } PathClass;
 
 extern const char *get_path(Node *node, PathClass class);
+extern ssize_t render_path(const Node *node, PathClass class, char *buffer, size_t size);
 extern void flush_path(Node *node, PathClass class);
 extern int set_actual_path(Node *node, const char *path);
+extern void reset_actual_path(Node *node);
+extern int revalidate_node(Node *node);
 
 #endif /* PROOT_VFS_PATH */
@@ -0,0 +1,400 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <stdlib.h>	/* malloc(3), realloc(3), free(3), */
+#include <string.h>	/* mem*(3), */
+#include <unistd.h>	/* sysconf(3), */
+#include <pthread.h>	/* pthread_*, */
+#include <assert.h>	/* assert(3), */
+#include <dirent.h>	/* DT_*, */
+#include <errno.h>	/* E*, */
+#include "vfs/prefetch.h"
+#include "vfs/children.h"
+#include "vfs/symlink.h"
+#include "vfs/node.h"
+#include "vfs/tree.h"
+
+/* Directory to fill, @level levels below the prefetched node.  */
+typedef struct {
+	Node *node;
+	size_t level;
+} Task;
+
+/* Tasks of a worker: this latter pushes and pops tasks at the tail,
+ * while other workers steal tasks at the head, that is, the oldest
+ * ones and likely the biggest subtrees.  No talloc context can be
+ * used without holding the tree lock, hence malloc(3).  */
+typedef struct {
+	pthread_mutex_t lock;
+	Task *tasks;
+	size_t head;
+	size_t tail;
+	size_t max_tasks;
+
+	/* Symlinks found by the current task, read once the tree
+	 * is unlocked.  */
+	Node **symlinks;
+	size_t max_symlinks;
+
+	struct prefetch *prefetch;
+	pthread_t thread;
+} Worker;
+
+typedef struct prefetch {
+	Tree *tree;
+	size_t generation;
+	size_t depth;
+	PrefetchFilter filter;
+	void *data;
+
+	Worker *workers;
+	size_t nb_workers;
+
+	/* Protects the counters below, and signals idle workers
+	 * whenever a task is queued or everything is done.  */
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	size_t nb_queued;
+	size_t nb_pending;
+	bool aborted;
+
+	size_t nb_filled;
+} Prefetch;
+
+/**
+ * Queue @node at the tail of @worker's tasks.  This function returns
+ * -ENOMEM if there's not enough memory, otherwise 0.
+ */
+static int push_task(Worker *worker, Node *node, size_t level)
+{
+	Prefetch *prefetch = worker->prefetch;
+
+	pthread_mutex_lock(&worker->lock);
+
+	if (worker->tail == worker->max_tasks) {
+		/* Reuse the room left by stolen tasks first.  */
+		if (worker->head > 0) {
+			memmove(worker->tasks, worker->tasks + worker->head,
+				(worker->tail - worker->head) * sizeof(Task));
+			worker->tail -= worker->head;
+			worker->head  = 0;
+		}
+		else {
+			size_t max = 2 * worker->max_tasks + 64;
+			Task *tasks;
+
+			tasks = realloc(worker->tasks, max * sizeof(Task));
+			if (tasks == NULL) {
+				pthread_mutex_unlock(&worker->lock);
+				return -ENOMEM;
+			}
+
+			worker->tasks = tasks;
+			worker->max_tasks = max;
+		}
+	}
+
+	worker->tasks[worker->tail].node  = node;
+	worker->tasks[worker->tail].level = level;
+	worker->tail++;
+
+	pthread_mutex_unlock(&worker->lock);
+
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch->nb_queued++;
+	prefetch->nb_pending++;
+	pthread_cond_signal(&prefetch->changed);
+	pthread_mutex_unlock(&prefetch->lock);
+
+	return 0;
+}
+
+/**
+ * Take in *@task either the newest task of @worker if @steal is
+ * false, or its oldest one otherwise.  This function returns false
+ * if @worker has no task.
+ */
+static bool take_task(Worker *worker, Task *task, bool steal)
+{
+	Prefetch *prefetch = worker->prefetch;
+	bool found = false;
+
+	pthread_mutex_lock(&worker->lock);
+
+	if (worker->head < worker->tail) {
+		if (steal)
+			*task = worker->tasks[worker->head++];
+		else
+			*task = worker->tasks[--worker->tail];
+		found = true;
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	if (found) {
+		pthread_mutex_lock(&prefetch->lock);
+		prefetch->nb_queued--;
+		pthread_mutex_unlock(&prefetch->lock);
+	}
+
+	return found;
+}
+
+/**
+ * Take in *@task the next task of @worker, stolen from another worker
+ * if needed.  This function waits until a task is available, and
+ * returns false once everything is done.
+ */
+static bool get_task(Worker *worker, Task *task)
+{
+	Prefetch *prefetch = worker->prefetch;
+	size_t index = worker - prefetch->workers;
+	bool done;
+	size_t i;
+
+	while (1) {
+		if (take_task(worker, task, false))
+			return true;
+
+		for (i = 1; i < prefetch->nb_workers; i++) {
+			Worker *victim = &prefetch->workers[(index + i) % prefetch->nb_workers];
+			if (take_task(victim, task, true))
+				return true;
+		}
+
+		pthread_mutex_lock(&prefetch->lock);
+		while (prefetch->nb_queued == 0 && prefetch->nb_pending > 0 && !prefetch->aborted)
+			pthread_cond_wait(&prefetch->changed, &prefetch->lock);
+		done = (prefetch->nb_pending == 0 || prefetch->aborted);
+		pthread_mutex_unlock(&prefetch->lock);
+
+		if (done)
+			return false;
+	}
+}
+
+/**
+ * Mark the task returned by get_task() as done.
+ */
+static void end_task(Prefetch *prefetch)
+{
+	pthread_mutex_lock(&prefetch->lock);
+	if (--prefetch->nb_pending == 0)
+		pthread_cond_broadcast(&prefetch->changed);
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+/**
+ * Stop all the workers of @prefetch, since a node it references might
+ * have been freed.
+ */
+static void abort_prefetch(Prefetch *prefetch)
+{
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch->aborted = true;
+	pthread_cond_broadcast(&prefetch->changed);
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+/**
+ * Fill the directory of @task, then queue its subdirectories in
+ * @worker's tasks, and read its symlinks.  Nodes are used only while
+ * the tree generation is the same as when the prefetch started.
+ */
+static void run_task(Worker *worker, const Task *task)
+{
+	Prefetch *prefetch = worker->prefetch;
+	Tree *tree = prefetch->tree;
+	size_t nb_symlinks = 0;
+	Node *child;
+	bool filled;
+	Fill fill;
+	int status;
+	size_t i;
+
+	read_lock_tree(tree);
+	if (get_generation(tree) != prefetch->generation) {
+		read_unlock_tree(tree);
+		abort_prefetch(prefetch);
+		return;
+	}
+
+	filled = task->node->children_filled;
+	status = filled ? 0 : start_fill(&fill, task->node);
+	read_unlock_tree(tree);
+
+	if (status >= 0 && !filled) {
+		status = finish_fill(&fill);
+		if (status >= 0)
+			__atomic_add_fetch(&prefetch->nb_filled, 1, __ATOMIC_RELAXED);
+	}
+
+	if (status < 0)
+		return;
+
+	read_lock_tree(tree);
+	if (get_generation(tree) != prefetch->generation) {
+		read_unlock_tree(tree);
+		abort_prefetch(prefetch);
+		return;
+	}
+
+	FOR_EACH_CHILD(child, task->node) {
+		if (child->negative || (child->type != DT_DIR && child->type != DT_LNK))
+			continue;
+
+		if (prefetch->filter != NULL && !prefetch->filter(child, prefetch->data))
+			continue;
+
+		if (child->type == DT_DIR) {
+			if (task->level < prefetch->depth)
+				(void) push_task(worker, child, task->level + 1);
+			continue;
+		}
+
+		if (__atomic_load_n(&child->symlink_, __ATOMIC_RELAXED) != NULL)
+			continue;
+
+		if (nb_symlinks == worker->max_symlinks) {
+			size_t max = 2 * worker->max_symlinks + 16;
+			Node **symlinks;
+
+			symlinks = realloc(worker->symlinks, max * sizeof(Node *));
+			if (symlinks == NULL)
+				continue;
+
+			worker->symlinks = symlinks;
+			worker->max_symlinks = max;
+		}
+
+		worker->symlinks[nb_symlinks++] = child;
+	}
+
+	read_unlock_tree(tree);
+
+	for (i = 0; i < nb_symlinks; i++) {
+		status = read_symlink(tree, worker->symlinks[i], prefetch->generation);
+		if (status == -EAGAIN) {
+			abort_prefetch(prefetch);
+			return;
+		}
+	}
+}
+
+static void *run_worker(void *data)
+{
+	Worker *worker = data;
+	Task task;
+
+	while (get_task(worker, &task)) {
+		run_task(worker, &task);
+		end_task(worker->prefetch);
+	}
+
+	return NULL;
+}
+
+/**
+ * Fill recursively @node's subtree, down to @depth levels below
+ * @node, and read all the symlinks of the filled directories.  This
+ * work is shared between @nb_threads threads -- or as many as CPUs if
+ * 0 -- that each fill directories depth-first, then steal the oldest
+ * pending directories of the others once they have nothing left to
+ * do.  Directories are read without holding the tree lock, see
+ * start_fill().  If @filter is not NULL, only the children for which
+ * @filter(child, @data) returns true are prefetched; it is called
+ * with the tree read-locked.  The prefetch stops early if nodes are
+ * flushed or evicted in the meantime.  The tree must not be locked by
+ * the current thread.  This function returns -errno if an error
+ * occurred, otherwise the number of directories it filled.
+ */
+ssize_t prefetch_tree(Node *node, size_t depth, PrefetchFilter filter, void *data,
+		size_t nb_threads)
+{
+	Prefetch prefetch;
+	size_t nb_created;
+	ssize_t status;
+	size_t i;
+
+	assert(!is_write_locked(node->tree));
+
+	if (node->type != DT_DIR)
+		return -ENOTDIR;
+
+	if (nb_threads == 0) {
+		long nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nb_threads = nb_cpus > 0 ? nb_cpus : 1;
+	}
+
+	memset(&prefetch, 0, sizeof(prefetch));
+	prefetch.tree   = node->tree;
+	prefetch.depth  = depth;
+	prefetch.filter = filter;
+	prefetch.data   = data;
+
+	prefetch.workers = calloc(nb_threads, sizeof(Worker));
+	if (prefetch.workers == NULL)
+		return -ENOMEM;
+
+	pthread_mutex_init(&prefetch.lock, NULL);
+	pthread_cond_init(&prefetch.changed, NULL);
+
+	for (i = 0; i < nb_threads; i++) {
+		pthread_mutex_init(&prefetch.workers[i].lock, NULL);
+		prefetch.workers[i].prefetch = &prefetch;
+	}
+	prefetch.nb_workers = nb_threads;
+
+	prefetch.generation = get_generation(node->tree);
+
+	/* The current thread is the first worker.  */
+	status = push_task(&prefetch.workers[0], node, 0);
+	if (status < 0)
+		goto end;
+
+	/* Fewer threads than expected is not an error: workers that
+	 * were not created never have tasks to steal.  */
+	for (nb_created = 1; nb_created < nb_threads; nb_created++) {
+		Worker *worker = &prefetch.workers[nb_created];
+		if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0)
+			break;
+	}
+
+	(void) run_worker(&prefetch.workers[0]);
+
+	for (i = 1; i < nb_created; i++)
+		pthread_join(prefetch.workers[i].thread, NULL);
+
+	status = prefetch.nb_filled;
+end:
+	for (i = 0; i < nb_threads; i++) {
+		pthread_mutex_destroy(&prefetch.workers[i].lock);
+		free(prefetch.workers[i].tasks);
+		free(prefetch.workers[i].symlinks);
+	}
+
+	pthread_mutex_destroy(&prefetch.lock);
+	pthread_cond_destroy(&prefetch.changed);
+	free(prefetch.workers);
+
+	return status;
+}
@@ -0,0 +1,37 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_PREFETCH
+#define PROOT_VFS_PREFETCH
+
+#include <stddef.h>	/* size_t, */
+#include <stdbool.h>	/* bool, */
+#include <sys/types.h>	/* ssize_t, */
+#include "vfs/node.h"
+
+/* Whether @node has to be prefetched, see prefetch_tree().  */
+typedef bool (* PrefetchFilter)(const Node *node, void *data);
+
+extern ssize_t prefetch_tree(Node *node, size_t depth, PrefetchFilter filter, void *data,
+			size_t nb_threads);
+
+#endif /* PROOT_VFS_PREFETCH */
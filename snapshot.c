@@ -0,0 +1,618 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <sys/mman.h>	/* mmap(2), munmap(2), */
+#include <sys/stat.h>	/* fstat(2), fstatat(2), struct stat, */
+#include <stdint.h>	/* uint*_t, */
+#include <stdlib.h>	/* qsort(3), */
+#include <string.h>	/* str*(3), mem*(3), */
+#include <unistd.h>	/* write(2), close(2), */
+#include <fcntl.h>	/* open(2), O_*, */
+#include <dirent.h>	/* DT_*, *dir(3), */
+#include <stdio.h>	/* rename(2), */
+#include <errno.h>	/* E*, errno(3), */
+#include <talloc.h>
+#include "vfs/snapshot.h"
+#include "vfs/node.h"
+#include "vfs/path.h"
+#include "vfs/symlink.h"
+#include "vfs/tree.h"
+
+#define SNAPSHOT_MAGIC "PRVFSSN1"
+
+/* Layout of a snapshot file: this header is followed by the record
+ * table then by the string table.  */
+struct snapshot_header
+{
+	char magic[8];
+
+	/* See compute_fingerprint().  */
+	uint64_t fingerprint;
+
+	uint32_t nb_records;
+	uint32_t strings_size;
+};
+
+/* Snapshot being built by save_snapshot().  */
+typedef struct {
+	SnapshotRecord *records;
+	const Node **nodes;
+	uint32_t nb_records;
+	uint32_t max_records;
+
+	char *strings;
+	uint32_t strings_size;
+	uint32_t max_strings;
+} Builder;
+
+/**
+ * Mix the @size bytes at @data into @hash, as in FNV-1a.
+ */
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+
+	return hash;
+}
+
+/**
+ * Mix into @hash the metadata of @statl that change whenever the
+ * content of the corresponding entry changes.
+ */
+static uint64_t hash_stat(uint64_t hash, const struct stat *statl)
+{
+	hash = hash_bytes(hash, &statl->st_dev,  sizeof(statl->st_dev));
+	hash = hash_bytes(hash, &statl->st_ino,  sizeof(statl->st_ino));
+	hash = hash_bytes(hash, &statl->st_mode, sizeof(statl->st_mode));
+	hash = hash_bytes(hash, &statl->st_size, sizeof(statl->st_size));
+	hash = hash_bytes(hash, &statl->st_mtim, sizeof(statl->st_mtim));
+	hash = hash_bytes(hash, &statl->st_ctim, sizeof(statl->st_ctim));
+
+	return hash;
+}
+
+/**
+ * Compute in *@fingerprint a cheap fingerprint of the file-system at
+ * @path, made of the metadata of @path and its entries.  The hashes
+ * of the entries are summed so as the order of readdir(3) doesn't
+ * matter.  This function returns -errno if an error occurred,
+ * otherwise 0.
+ */
+static int compute_fingerprint(const char *path, uint64_t *fingerprint)
+{
+	struct dirent *entry;
+	struct stat statl;
+	uint64_t sum = 0;
+	DIR *directory;
+	int status;
+
+	status = lstat(path, &statl);
+	if (status < 0)
+		return -errno;
+
+	*fingerprint = hash_stat(14695981039346656037ULL, &statl);
+
+	directory = opendir(path);
+	if (directory == NULL)
+		return -errno;
+
+	while ((entry = readdir(directory)) != NULL) {
+		uint64_t hash = 14695981039346656037ULL;
+
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		status = fstatat(dirfd(directory), entry->d_name, &statl, AT_SYMLINK_NOFOLLOW);
+		if (status < 0)
+			continue;
+
+		hash = hash_bytes(hash, entry->d_name, strlen(entry->d_name));
+		sum += hash_stat(hash, &statl);
+	}
+
+	(void) closedir(directory);
+
+	*fingerprint += sum;
+	return 0;
+}
+
+/**
+ * Copy @string at the end of @builder string table.  This function
+ * returns -errno if an error occurred, otherwise the offset of the
+ * copy.
+ */
+static int64_t add_string(Builder *builder, const char *string)
+{
+	size_t size = strlen(string) + 1;
+	uint32_t offset;
+
+	if (builder->strings_size + size > builder->max_strings) {
+		size_t max = 2 * (builder->max_strings + size);
+		char *strings;
+
+		if (max > UINT32_MAX)
+			return -EFBIG;
+
+		strings = talloc_realloc(builder, builder->strings, char, max);
+		if (strings == NULL)
+			return -ENOMEM;
+
+		builder->strings = strings;
+		builder->max_strings = max;
+	}
+
+	offset = builder->strings_size;
+	memcpy(builder->strings + offset, string, size);
+	builder->strings_size += size;
+
+	return offset;
+}
+
+/**
+ * Add to @builder a record for @node, to be completed later by
+ * add_children().  This function returns -errno if an error
+ * occurred, otherwise 0.
+ */
+static int add_record(Builder *builder, const Node *node)
+{
+	SnapshotRecord *record;
+	int64_t offset;
+
+	if (builder->nb_records == builder->max_records) {
+		size_t max = 2 * builder->max_records + 64;
+		SnapshotRecord *records;
+		const Node **nodes;
+
+		if (max > UINT32_MAX)
+			return -EFBIG;
+
+		records = talloc_realloc(builder, builder->records, SnapshotRecord, max);
+		if (records == NULL)
+			return -ENOMEM;
+		builder->records = records;
+
+		nodes = talloc_realloc(builder, builder->nodes, const Node *, max);
+		if (nodes == NULL)
+			return -ENOMEM;
+		builder->nodes = nodes;
+
+		builder->max_records = max;
+	}
+
+	offset = add_string(builder, node->name);
+	if (offset < 0)
+		return offset;
+
+	record = &builder->records[builder->nb_records];
+	memset(record, 0, sizeof(SnapshotRecord));
+	record->name = offset;
+	record->type = node->type;
+
+	builder->nodes[builder->nb_records] = node;
+	builder->nb_records++;
+
+	return 0;
+}
+
+static int compare_nodes(const void *a, const void *b)
+{
+	return strcmp((*(const Node **) a)->name, (*(const Node **) b)->name);
+}
+
+/**
+ * Check whether the listing of @node, the top node of the snapshot
+ * if @is_top is true, reflects its actual directory.
+ */
+static bool is_saveable(const Node *node, bool is_top)
+{
+	const Node *child;
+
+	if (!node->children_filled || (node->special && !is_top) || node->attached_evaluator != NULL)
+		return false;
+
+	/* Special children are not part of the actual directory.  */
+	FOR_EACH_CHILD(child, node) {
+		if (child->special || child->attached_evaluator != NULL)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Complete the @index-th record of @builder with the symlink target
+ * of its node, and add records for the children of this latter.
+ * This function returns -errno if an error occurred, otherwise 0.
+ */
+static int add_children(Builder *builder, uint32_t index, bool is_top)
+{
+	Node *node = (Node *) builder->nodes[index];
+	const Node **children;
+	uint32_t nb_children;
+	int status = 0;
+	Node *child;
+	int64_t offset;
+	uint32_t i;
+
+	if (node->type == DT_LNK && !node->special) {
+		int error;
+		const char *symlink = get_symlink(node, &error);
+		if (symlink != NULL) {
+			offset = add_string(builder, symlink);
+			if (offset < 0)
+				return offset;
+			builder->records[index].symlink = offset + 1;
+		}
+	}
+
+	if (!is_saveable(node, is_top))
+		return 0;
+
+	nb_children = node->children.nb_nodes;
+	children = talloc_array(builder, const Node *, nb_children);
+	if (children == NULL && nb_children > 0)
+		return -ENOMEM;
+
+	/* Negative children are not part of the actual directory.  */
+	nb_children = 0;
+	FOR_EACH_CHILD(child, node) {
+		if (!child->negative)
+			children[nb_children++] = child;
+	}
+
+	qsort(children, nb_children, sizeof(Node *), compare_nodes);
+
+	builder->records[index].filled = true;
+	builder->records[index].children = builder->nb_records;
+	builder->records[index].nb_children = nb_children;
+
+	for (i = 0; i < nb_children; i++) {
+		status = add_record(builder, children[i]);
+		if (status < 0)
+			break;
+	}
+
+	talloc_free(children);
+	return status < 0 ? status : 0;
+}
+
+/**
+ * Write the @size bytes at @data in @fd.  This function returns
+ * -errno if an error occurred, otherwise 0.
+ */
+static int write_all(int fd, const void *data, size_t size)
+{
+	const char *cursor = data;
+
+	while (size > 0) {
+		ssize_t result = write(fd, cursor, size);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		cursor += result;
+		size -= result;
+	}
+
+	return 0;
+}
+
+/**
+ * Save into the file at @path the names, types, symlink targets and
+ * filled state of @node and of all its descendants, as populated so
+ * far.  The listing of a directory is saved only if it reflects the
+ * actual directory, that is, if it was filled and it has no special
+ * children.  This file can be loaded later with load_snapshot().
+ * This function returns -errno if an error occurred, otherwise 0.
+ */
+int save_snapshot(Node *node, const char *path)
+{
+	struct snapshot_header header;
+	const char *actual_path;
+	char *tmp_path = NULL;
+	Builder *builder;
+	int status;
+	uint32_t i;
+	int fd;
+
+	builder = talloc_zero(NULL, Builder);
+	if (builder == NULL)
+		return -ENOMEM;
+
+	write_lock_tree(node->tree);
+
+	actual_path = get_path(node, ACTUAL_PATH);
+	if (actual_path == NULL) {
+		status = -ENOMEM;
+		goto end;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+
+	status = compute_fingerprint(actual_path, &header.fingerprint);
+	if (status < 0)
+		goto end;
+
+	/* Records are added in breadth-first order, so as children
+	 * of a node are contiguous.  */
+	status = add_record(builder, node);
+	for (i = 0; status >= 0 && i < builder->nb_records; i++)
+		status = add_children(builder, i, i == 0);
+	if (status < 0)
+		goto end;
+
+	header.nb_records   = builder->nb_records;
+	header.strings_size = builder->strings_size;
+
+	tmp_path = talloc_asprintf(builder, "%s.tmp", path);
+	if (tmp_path == NULL) {
+		status = -ENOMEM;
+		goto end;
+	}
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		status = -errno;
+		goto end;
+	}
+
+	status = write_all(fd, &header, sizeof(header));
+	if (status >= 0)
+		status = write_all(fd, builder->records,
+				builder->nb_records * sizeof(SnapshotRecord));
+	if (status >= 0)
+		status = write_all(fd, builder->strings, builder->strings_size);
+
+	if (close(fd) < 0 && status >= 0)
+		status = -errno;
+
+	/* The snapshot is replaced atomically.  */
+	if (status >= 0 && rename(tmp_path, path) < 0)
+		status = -errno;
+
+	if (status < 0)
+		(void) unlink(tmp_path);
+end:
+	write_unlock_tree(node->tree);
+	talloc_free(builder);
+
+	return status;
+}
+
+/**
+ * Check whether the tables of @snapshot are consistent, so as they
+ * can be used without further checks.
+ */
+static bool is_valid_snapshot(const Snapshot *snapshot)
+{
+	uint32_t i;
+
+	if (snapshot->nb_records == 0
+	    || snapshot->strings_size == 0
+	    || snapshot->strings[snapshot->strings_size - 1] != '\0')
+		return false;
+
+	for (i = 0; i < snapshot->nb_records; i++) {
+		const SnapshotRecord *record = &snapshot->records[i];
+
+		if (record->name >= snapshot->strings_size
+		    || record->symlink > snapshot->strings_size)
+			return false;
+
+		/* Children are stored after their parent, this
+		 * ensures there's no cycle.  */
+		if (record->nb_children > 0
+		    && (record->children <= i
+			|| record->children > snapshot->nb_records
+			|| record->nb_children > snapshot->nb_records - record->children))
+			return false;
+	}
+
+	return true;
+}
+
+static int snapshot_destructor(Snapshot *snapshot)
+{
+	(void) munmap(snapshot->base, snapshot->size);
+	return 0;
+}
+
+/**
+ * Map the snapshot file at @path, as saved by save_snapshot(), and
+ * use it to fill the directories of @root's tree: their entries are
+ * then taken from this snapshot instead of the actual file-system,
+ * except in the subtrees of special nodes.  This snapshot is used
+ * only while @root actual path is the same, and only if the
+ * fingerprint of this latter has not changed.  This function returns
+ * -ESTALE if the snapshot doesn't match, -errno if another error
+ * occurred, otherwise 0.
+ */
+int load_snapshot(Node *root, const char *path)
+{
+	struct snapshot_header *header;
+	const char *actual_path;
+	uint64_t fingerprint;
+	Snapshot *snapshot;
+	struct stat statl;
+	size_t size;
+	void *base;
+	int status;
+	int fd;
+
+	if (root->parent != root)
+		return -EINVAL;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	status = fstat(fd, &statl);
+	if (status < 0 || (size_t) statl.st_size < sizeof(struct snapshot_header)) {
+		status = status < 0 ? -errno : -EINVAL;
+		(void) close(fd);
+		return status;
+	}
+
+	size = statl.st_size;
+	base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		status = -errno;
+		(void) close(fd);
+		return status;
+	}
+	(void) close(fd);
+
+	snapshot = talloc_zero(NULL, Snapshot);
+	if (snapshot == NULL) {
+		(void) munmap(base, size);
+		return -ENOMEM;
+	}
+
+	snapshot->base = base;
+	snapshot->size = size;
+	talloc_set_destructor(snapshot, snapshot_destructor);
+
+	header = base;
+	if (   memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+	    || header->nb_records > (size - sizeof(*header)) / sizeof(SnapshotRecord)
+	    || header->strings_size != size - sizeof(*header)
+					- header->nb_records * sizeof(SnapshotRecord)) {
+		status = -EINVAL;
+		goto error;
+	}
+
+	snapshot->records      = (const SnapshotRecord *) (header + 1);
+	snapshot->nb_records   = header->nb_records;
+	snapshot->strings      = (const char *) (snapshot->records + snapshot->nb_records);
+	snapshot->strings_size = header->strings_size;
+
+	if (!is_valid_snapshot(snapshot)) {
+		status = -EINVAL;
+		goto error;
+	}
+
+	actual_path = get_path(root, ACTUAL_PATH);
+	if (actual_path == NULL) {
+		status = -ENOMEM;
+		goto error;
+	}
+
+	status = compute_fingerprint(actual_path, &fingerprint);
+	if (status < 0)
+		goto error;
+
+	if (fingerprint != header->fingerprint) {
+		status = -ESTALE;
+		goto error;
+	}
+
+	snapshot->root_path = talloc_strdup(snapshot, actual_path);
+	if (snapshot->root_path == NULL) {
+		status = -ENOMEM;
+		goto error;
+	}
+
+	write_lock_tree(root->tree);
+
+	/* Nodes filled so far are still valid, however a previous
+	 * snapshot might be referenced by pending fills.  */
+	bump_generation(root);
+	TALLOC_FREE(root->tree->snapshot);
+	root->tree->snapshot = talloc_steal(root->tree, snapshot);
+
+	write_unlock_tree(root->tree);
+
+	return 0;
+
+error:
+	talloc_free(snapshot);
+	return status;
+}
+
+/**
+ * Find the record of @node in @snapshot, recursively from the root.
+ */
+static const SnapshotRecord *find_record(const Snapshot *snapshot, const Node *node)
+{
+	const SnapshotRecord *parent;
+	const char *path;
+	uint32_t first;
+	uint32_t last;
+
+	if (node->parent == node) {
+		path = __atomic_load_n(&node->path_.actual, __ATOMIC_ACQUIRE);
+		if (path == NULL || strcmp(path, snapshot->root_path) != 0)
+			return NULL;
+
+		return &snapshot->records[0];
+	}
+
+	/* The actual path of a special node is not in the snapshot,
+	 * neither are negative entries.  */
+	if (node->special || node->negative)
+		return NULL;
+
+	parent = find_record(snapshot, node->parent);
+	if (parent == NULL || !parent->filled)
+		return NULL;
+
+	/* Binary search among the children, sorted by name.  */
+	first = parent->children;
+	last  = parent->children + parent->nb_children;
+	while (first < last) {
+		uint32_t middle = first + (last - first) / 2;
+		const char *name = get_snapshot_string(snapshot, snapshot->records[middle].name);
+		int comparison = strcmp(node->name, name);
+
+		if (comparison == 0)
+			return &snapshot->records[middle];
+
+		if (comparison < 0)
+			last = middle;
+		else
+			first = middle + 1;
+	}
+
+	return NULL;
+}
+
+/**
+ * Get the record of @node in the snapshot of its tree, if any.  The
+ * tree has to be locked, at least for reading.  This function
+ * returns NULL if there's no snapshot, or if @node is not in it.
+ */
+const SnapshotRecord *find_snapshot_record(const Node *node)
+{
+	const Snapshot *snapshot = node->tree->snapshot;
+
+	if (snapshot == NULL)
+		return NULL;
+
+	return find_record(snapshot, node);
+}
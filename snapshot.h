@@ -0,0 +1,82 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_SNAPSHOT
+#define PROOT_VFS_SNAPSHOT
+
+#include <stdint.h>	/* uint*_t, */
+#include <stddef.h>	/* size_t, */
+#include "vfs/node.h"
+
+/* Description of a node in a snapshot file, see save_snapshot().
+ * Strings are referenced by their offset in the string table, and
+ * children by the index of the first one in the record table, so as
+ * the file can be mapped anywhere.  */
+typedef struct {
+	uint32_t name;
+
+	/* Offset of the symlink target + 1, or 0 if there's none.  */
+	uint32_t symlink;
+
+	/* Children are stored contiguously, sorted by name.  */
+	uint32_t children;
+	uint32_t nb_children;
+
+	uint8_t type;
+
+	/* Whether the children of this directory are all there, as
+	 * node->children_filled.  */
+	uint8_t filled;
+
+	uint16_t reserved;
+} SnapshotRecord;
+
+/* Snapshot file mapped in memory, see load_snapshot().  */
+typedef struct snapshot
+{
+	void *base;
+	size_t size;
+
+	const SnapshotRecord *records;
+	uint32_t nb_records;
+
+	const char *strings;
+	uint32_t strings_size;
+
+	/* Actual path of the root when this snapshot was loaded, it
+	 * is not used anymore once this path is changed.  */
+	char *root_path;
+} Snapshot;
+
+extern int save_snapshot(Node *node, const char *path);
+extern int load_snapshot(Node *root, const char *path);
+extern const SnapshotRecord *find_snapshot_record(const Node *node);
+
+/**
+ * Get the string at @offset in the string table of @snapshot.
+ */
+static inline const char *get_snapshot_string(const Snapshot *snapshot, uint32_t offset)
+{
+	return snapshot->strings + offset;
+}
+
+#endif /* PROOT_VFS_SNAPSHOT */
@@ -0,0 +1,150 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+
+#include <stdio.h>	/* dprintf(3), */
+#include <string.h>	/* memset(3), */
+#include <errno.h>	/* errno(3), ENOMEM, */
+#include <inttypes.h>	/* PRIu64, */
+#include <talloc.h>
+#include "vfs/stats.h"
+#include "vfs/node.h"
+#include "vfs/tree.h"
+
+static const char *counter_names[NB_STATS] = {
+	[STAT_LOOKUPS]		= "lookups",
+	[STAT_LOOKUP_HITS]	= "lookup_hits",
+	[STAT_COMPONENTS]	= "components",
+	[STAT_FILLS]		= "fills",
+	[STAT_ENTRIES]		= "entries",
+	[STAT_READLINKS]	= "readlinks",
+	[STAT_SYMLINK_HOPS]	= "symlink_hops",
+	[STAT_ELOOP]		= "eloop",
+	[STAT_ENOENT]		= "enoent",
+	[STAT_FLUSHES]		= "flushes",
+	[STAT_NODES]		= "nodes",
+	[STAT_BYTES]		= "bytes",
+	[STAT_EVALUATIONS]	= "evaluations",
+	[STAT_EVALUATION_HITS]	= "evaluation_hits",
+	[STAT_REBINDINGS]	= "rebindings",
+	[STAT_REVALIDATIONS]	= "revalidations",
+};
+
+static const char *latency_names[NB_LATENCIES] = {
+	[LATENCY_FIND_NODE]	= "find_node",
+	[LATENCY_FILL]		= "fill",
+	[LATENCY_GET_PATH]	= "get_path",
+};
+
+/**
+ * Allocate the statistics of @tree, a newly initialized tree with its
+ * root node, if they are compiled in.  This function returns -ENOMEM
+ * if there's not enough memory, otherwise 0.
+ */
+int init_tree_stats(Tree *tree)
+{
+#ifdef VFS_STATS
+	tree->stats = talloc_zero(tree, TreeStats);
+	if (tree->stats == NULL)
+		return -ENOMEM;
+
+	talloc_set_name_const(tree->stats, "$stats");
+
+	tree->stats->counters[STAT_NODES] = 1;
+#else
+	(void) tree;
+#endif
+	return 0;
+}
+
+/**
+ * Fill @stats with a snapshot of the statistics of @node's tree.
+ * Only the counters that are maintained anyway -- lookups, hits,
+ * bytes and evaluations -- are non-zero if statistics are compiled
+ * out.  The tree doesn't have to be locked.
+ */
+void get_tree_stats(const Node *node, TreeStats *stats)
+{
+	const Tree *tree = node->tree;
+	size_t i;
+	size_t j;
+
+	memset(stats, 0, sizeof(*stats));
+
+#ifdef VFS_STATS
+	for (i = 0; i < NB_STATS; i++)
+		stats->counters[i] = __atomic_load_n(&tree->stats->counters[i], __ATOMIC_RELAXED);
+
+	for (i = 0; i < NB_LATENCIES; i++) {
+		for (j = 0; j < NB_LATENCY_BUCKETS; j++)
+			stats->latencies[i][j] = __atomic_load_n(&tree->stats->latencies[i][j],
+								__ATOMIC_RELAXED);
+	}
+#else
+	(void) i;
+	(void) j;
+#endif
+
+	/* Every top-level lookup goes through the lookup cache.  */
+	stats->counters[STAT_LOOKUP_HITS] = __atomic_load_n(&tree->lookup_cache.hits, __ATOMIC_RELAXED);
+	stats->counters[STAT_LOOKUPS] = stats->counters[STAT_LOOKUP_HITS]
+		+ __atomic_load_n(&tree->lookup_cache.misses, __ATOMIC_RELAXED);
+
+	stats->counters[STAT_BYTES] = __atomic_load_n(&tree->memory.usage, __ATOMIC_RELAXED);
+
+	/* So are evaluations.  */
+	stats->counters[STAT_EVALUATIONS] = __atomic_load_n(&tree->evaluators.calls, __ATOMIC_RELAXED);
+	stats->counters[STAT_EVALUATION_HITS] = __atomic_load_n(&tree->evaluators.hits, __ATOMIC_RELAXED);
+}
+
+/**
+ * Write in @fd the statistics of @node's tree, one per line: first
+ * "stat name=value" lines, then "latency op=name lt_ns=bound
+ * count=value" lines for the non-empty buckets of each histogram.
+ * This function returns -errno if an error occurred, otherwise 0.
+ */
+int dump_tree_stats(const Node *node, int fd)
+{
+	TreeStats stats;
+	size_t i;
+	size_t j;
+
+	get_tree_stats(node, &stats);
+
+	for (i = 0; i < NB_STATS; i++) {
+		if (dprintf(fd, "stat %s=%" PRIu64 "\n", counter_names[i], stats.counters[i]) < 0)
+			return -errno;
+	}
+
+	for (i = 0; i < NB_LATENCIES; i++) {
+		for (j = 0; j < NB_LATENCY_BUCKETS; j++) {
+			if (stats.latencies[i][j] == 0)
+				continue;
+
+			if (dprintf(fd, "latency op=%s lt_ns=%" PRIu64 " count=%" PRIu64 "\n",
+					latency_names[i], (uint64_t) 1 << j, stats.latencies[i][j]) < 0)
+				return -errno;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,136 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_STATS
+#define PROOT_VFS_STATS
+
+#include <stdint.h>	/* uint64_t, */
+#include <time.h>	/* clock_gettime(3), */
+#include "vfs/node.h"
+#include "vfs/tree.h"
+
+/* Counters of a tree, see count_stat().  */
+typedef enum {
+	STAT_LOOKUPS,		/* Top-level lookups.  */
+	STAT_LOOKUP_HITS,	/* Lookups served by the lookup cache.  */
+	STAT_COMPONENTS,	/* Path components walked.  */
+	STAT_FILLS,		/* Directories read from the file-system.  */
+	STAT_ENTRIES,		/* Directory entries read from the file-system.  */
+	STAT_READLINKS,		/* Symbolic links read from the file-system.  */
+	STAT_SYMLINK_HOPS,	/* Symbolic links followed.  */
+	STAT_ELOOP,		/* Lookups failed with ELOOP.  */
+	STAT_ENOENT,		/* Lookups failed with ENOENT.  */
+	STAT_FLUSHES,		/* Calls to flush_children().  */
+	STAT_NODES,		/* Nodes in the tree.  */
+	STAT_BYTES,		/* Estimated memory used, see account_memory().  */
+	STAT_EVALUATIONS,	/* Calls to evaluators.  */
+	STAT_EVALUATION_HITS,	/* Evaluations reused, see evaluate_node().  */
+	STAT_REBINDINGS,	/* Bindings installed, replaced or removed.  */
+	STAT_REVALIDATIONS,	/* Nodes flushed after a rebinding, see revalidate_node().  */
+	NB_STATS,
+} StatCounter;
+
+/* Operations whose latency is recorded, see record_latency().  */
+typedef enum {
+	LATENCY_FIND_NODE,	/* Top-level find_node_().  */
+	LATENCY_FILL,		/* Reading and adding the entries of a directory.  */
+	LATENCY_GET_PATH,	/* get_path() when the path is computed.  */
+	NB_LATENCIES,
+} StatLatency;
+
+/* Bucket i counts durations in [2^(i-1), 2^i) nanoseconds, and the
+ * last one counts longer durations as well.  */
+#define NB_LATENCY_BUCKETS 40
+
+/* Snapshot of the statistics of a tree, see get_tree_stats().  */
+typedef struct stats {
+	uint64_t counters[NB_STATS];
+	uint64_t latencies[NB_LATENCIES][NB_LATENCY_BUCKETS];
+} TreeStats;
+
+extern int init_tree_stats(Tree *tree);
+extern void get_tree_stats(const Node *node, TreeStats *stats);
+extern int dump_tree_stats(const Node *node, int fd);
+
+#ifdef VFS_STATS
+
+/**
+ * Add @value to the @counter of @tree.
+ */
+static inline void count_stat(Tree *tree, StatCounter counter, int64_t value)
+{
+	__atomic_add_fetch(&tree->stats->counters[counter], (uint64_t) value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the start time of an operation, see record_latency().
+ */
+static inline uint64_t start_latency(void)
+{
+	struct timespec now;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Record in @tree the duration of the @latency operation that
+ * started at @start, as returned by start_latency().
+ */
+static inline void record_latency(Tree *tree, StatLatency latency, uint64_t start)
+{
+	uint64_t duration = start_latency() - start;
+	unsigned int bucket;
+
+	bucket = (duration == 0 ? 0 : 64 - __builtin_clzll(duration));
+	if (bucket >= NB_LATENCY_BUCKETS)
+		bucket = NB_LATENCY_BUCKETS - 1;
+
+	__atomic_add_fetch(&tree->stats->latencies[latency][bucket], 1, __ATOMIC_RELAXED);
+}
+
+#else /* !VFS_STATS */
+
+/* Statistics are compiled out, so as they cost nothing.  */
+
+static inline void count_stat(Tree *tree, StatCounter counter, int64_t value)
+{
+	(void) tree;
+	(void) counter;
+	(void) value;
+}
+
+static inline uint64_t start_latency(void)
+{
+	return 0;
+}
+
+static inline void record_latency(Tree *tree, StatLatency latency, uint64_t start)
+{
+	(void) tree;
+	(void) latency;
+	(void) start;
+}
+
+#endif /* VFS_STATS */
+
+#endif /* PROOT_VFS_STATS */
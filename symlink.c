@@ -23,18 +23,27 @@
 #include <dirent.h>	/* DT_LNK, */
 #include <unistd.h>	/* readlink(2), */
 #include <errno.h>	/* E*, errno(3), */
+#include <limits.h>	/* PATH_MAX, */
+#include <stdbool.h>	/* bool, */
 #include <talloc.h>
 #include "vfs/symlink.h"
 #include "vfs/node.h"
 #include "vfs/path.h"
+#include "vfs/tree.h"
+#include "vfs/memory.h"
+#include "vfs/snapshot.h"
+#include "vfs/descriptor.h"
+#include "vfs/stats.h"
 
 /**
- * Allocate for @context a new symlink built from @node.  This
- * function returns NULL if there's not enough memory, and *@error is
+ * Allocate for @context a new symlink built from @node, or copied
+ * from the snapshot of its tree if it is there.  This function
+ * returns NULL if there's not enough memory, and *@error is
  * set to -errno.
  */
 static char *new_symlink_from_node(TALLOC_CTX *context, Node *node, int *error)
 {
+	const SnapshotRecord *record;
 	char *symlink = NULL;
 	const char *path;
 	ssize_t result;
@@ -46,10 +55,25 @@ static char *new_symlink_from_node(TALLOC_CTX *context, Node *node, int *error)
 		return NULL;
 	}
 
-	path = get_path(node, ACTUAL_PATH);
-	if (path == NULL) {
-		*error = -ENOMEM;
-		return NULL;
+	record = find_snapshot_record(node);
+	if (record != NULL && record->symlink != 0) {
+		const Snapshot *snapshot = node->tree->snapshot;
+
+		symlink = talloc_strdup(context, get_snapshot_string(snapshot, record->symlink - 1));
+		if (symlink == NULL)
+			*error = -ENOMEM;
+		return symlink;
+	}
+
+	/* Links are read relatively to the descriptor of their
+	 * parent, if any.  */
+	path = NULL;
+	if (!uses_descriptors(node->tree)) {
+		path = get_path(node, ACTUAL_PATH);
+		if (path == NULL) {
+			*error = -ENOMEM;
+			return NULL;
+		}
 	}
 
 	/* Start from a reasonable size.  */
@@ -63,9 +87,18 @@ static char *new_symlink_from_node(TALLOC_CTX *context, Node *node, int *error)
 			goto free_symlink;
 		}
 
-		result = readlink(path, symlink, size);
+		count_stat(node->tree, STAT_READLINKS, 1);
+
+		if (path == NULL)
+			result = read_link(node, symlink, size);
+		else {
+			result = readlink(path, symlink, size);
+			if (result < 0)
+				result = -errno;
+		}
+
 		if (result < 0) {
-			*error = -errno;
+			*error = result;
 			goto free_symlink;
 		}
 	} while (result == size && size > 0);
@@ -94,20 +127,221 @@ free_symlink:
 	return NULL;
 }
 
+/**
+ * Publish @symlink as @node->symlink_, so as it can be read without
+ * locking the tree.  The slot where the resolution of this link is
+ * memoized is allocated at the same time, since this latter is
+ * written without holding the write lock, see store_resolution().
+ * The tree has to be write-locked.
+ */
+static void publish_symlink(Node *node, char *symlink)
+{
+	talloc_set_name_const(symlink, "$symlink");
+	account_memory(node->tree, string_footprint(symlink));
+	__atomic_store_n(&node->symlink_, symlink, __ATOMIC_RELEASE);
+
+	if (node->resolution_ != NULL)
+		return;
+
+	/* Links are still resolved if there's not enough memory,
+	 * just not memoized.  */
+	node->resolution_ = talloc_zero(node, Resolution);
+	if (node->resolution_ == NULL)
+		return;
+
+	talloc_set_name_const(node->resolution_, "$resolution");
+	account_memory(node->tree, TALLOC_CHUNK_SIZE(sizeof(Resolution)));
+}
+
 /**
  * Get @node->symlink, however this function is similar to
  * new_symlink_from_node(@node, @node) if it was not computed yet.
+ * Once computed, this symlink is read without locking the tree.
  */
 const char *get_symlink(Node *node, int *error)
 {
-	if (node->symlink_ != NULL)
-		return node->symlink_;
+	char *symlink;
 
-	node->symlink_ = new_symlink_from_node(node, node, error);
-	if (node->symlink_ == NULL)
-		return NULL;
+	symlink = __atomic_load_n(&node->symlink_, __ATOMIC_ACQUIRE);
+	if (symlink != NULL)
+		return symlink;
+
+	write_lock_tree(node->tree);
+
+	symlink = node->symlink_;
+	if (symlink == NULL) {
+		symlink = new_symlink_from_node(node, node, error);
+		if (symlink != NULL)
+			publish_symlink(node, symlink);
+	}
+
+	write_unlock_tree(node->tree);
+
+	return symlink;
+}
+
+/**
+ * Compute @node->symlink_, as get_symlink() does, however the link is
+ * read without holding the lock of @tree, so as several threads can
+ * read links concurrently.  @node is used only while the generation
+ * of @tree is still @generation, as when @node was found.  The tree
+ * must not be locked by the current thread.  This function returns
+ * -EAGAIN if the generation has changed, -errno if another error
+ * occurred, otherwise 0.
+ */
+int read_symlink(Tree *tree, Node *node, size_t generation)
+{
+	char target[PATH_MAX];
+	char path[PATH_MAX];
+	bool is_cheap = false;
+	bool is_done = false;
+	bool is_read = false;
+	ssize_t size = 0;
+	int status = 0;
+
+	read_lock_tree(tree);
+
+	if (get_generation(tree) != generation)
+		status = -EAGAIN;
+	else if (node->type != DT_LNK)
+		status = -EINVAL;
+	else if (node->symlink_ == NULL) {
+		/* Links in the snapshot are copied with the lock, and
+		 * so are links read relatively to the descriptor of
+		 * their parent since this latter is pinned only while
+		 * the tree is locked.  */
+		is_cheap = (find_snapshot_record(node) != NULL);
+		if (!is_cheap && uses_descriptors(tree)) {
+			is_read = true;
+			count_stat(tree, STAT_READLINKS, 1);
+			size = read_link(node, target, sizeof(target));
+		}
+		else if (!is_cheap)
+			size = render_path(node, ACTUAL_PATH, path, sizeof(path));
+	}
+	else
+		is_done = true;
+
+	read_unlock_tree(tree);
+
+	if (status < 0 || is_done)
+		return status;
+
+	if (is_read) {
+		if (size < 0)
+			return size;
+
+		if ((size_t) size >= sizeof(target))
+			return -ENAMETOOLONG;
+
+		target[size] = '\0';
+	}
+	else if (!is_cheap) {
+		if (size < 0)
+			return -ENAMETOOLONG;
+
+		count_stat(tree, STAT_READLINKS, 1);
+		size = readlink(path, target, sizeof(target));
+		if (size < 0)
+			return -errno;
+
+		if ((size_t) size >= sizeof(target))
+			return -ENAMETOOLONG;
+
+		target[size] = '\0';
+	}
+
+	write_lock_tree(tree);
+
+	if (get_generation(tree) != generation)
+		status = -EAGAIN;
+	else if (node->symlink_ == NULL) {
+		char *symlink;
+
+		if (is_cheap)
+			symlink = new_symlink_from_node(node, node, &status);
+		else {
+			symlink = talloc_strdup(node, target);
+			if (symlink == NULL)
+				status = -ENOMEM;
+		}
+
+		if (symlink != NULL)
+			publish_symlink(node, symlink);
+	}
+
+	write_unlock_tree(tree);
+
+	return status;
+}
+
+/**
+ * Copy in @resolution the resolution memoized for @node, if any.  This
+ * function returns false if there's no such resolution, or if it was
+ * computed before the tree was modified.  Negative results are also
+ * invalidated once a node was created by a lookup.  The tree has to
+ * be locked, at least for reading: the memoized resolution is
+ * protected by a sequence counter, readers miss if it was written in
+ * the meantime, as in lookup_cache_get().
+ */
+bool load_resolution(const Node *node, Resolution *resolution)
+{
+	const Resolution *memo = node->resolution_;
+	const Tree *tree = node->tree;
+	uint32_t sequence;
+
+	if (memo == NULL)
+		return false;
+
+	sequence = __atomic_load_n(&memo->sequence, __ATOMIC_ACQUIRE);
+	if ((sequence & 1) != 0 || memo->root == NULL)
+		return false;
+
+	*resolution = *memo;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&memo->sequence, __ATOMIC_RELAXED) != sequence)
+		return false;
+
+	if (resolution->generation != get_generation(tree))
+		return false;
+
+	if (   resolution->error != 0
+	    && resolution->creations != __atomic_load_n(&tree->creations, __ATOMIC_ACQUIRE))
+		return false;
+
+	return true;
+}
+
+/**
+ * Memoize @resolution for @node, a symbolic link, with the current
+ * generation and number of creations of the tree.  The tree has to be
+ * locked, at least for reading, so as the target is not flushed in
+ * the meantime.  Nothing is memoized if another thread is doing the
+ * same.
+ */
+void store_resolution(Node *node, const Resolution *resolution)
+{
+	Resolution *memo = node->resolution_;
+	uint32_t sequence;
+
+	if (memo == NULL)
+		return;
+
+	/* Give up if another thread is writing this resolution.  */
+	sequence = __atomic_load_n(&memo->sequence, __ATOMIC_RELAXED);
+	if ((sequence & 1) != 0
+	    || !__atomic_compare_exchange_n(&memo->sequence, &sequence, sequence + 1,
+					false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
 
-	talloc_set_name_const(node->symlink_, "$symlink");
+	memo->error      = resolution->error;
+	memo->target     = resolution->target;
+	memo->root       = resolution->root;
+	memo->count      = resolution->count;
+	memo->depth      = resolution->depth;
+	memo->generation = get_generation(node->tree);
+	memo->creations  = __atomic_load_n(&node->tree->creations, __ATOMIC_ACQUIRE);
 
-	return node->symlink_;
+	__atomic_store_n(&memo->sequence, sequence + 2, __ATOMIC_RELEASE);
 }
@@ -23,8 +23,41 @@
 #ifndef PROOT_VFS_SYMLINK
 #define PROOT_VFS_SYMLINK
 
+#include <stddef.h>	/* size_t, */
+#include <stdint.h>	/* uint32_t, */
+#include <stdbool.h>	/* bool, */
 #include "vfs/node.h"
+#include "vfs/tree.h"
+
+/* Result of the resolution of a symbolic link, see
+ * follow_symlink_node().  */
+typedef struct resolution
+{
+	/* Odd while this resolution is being written, see
+	 * store_resolution().  */
+	uint32_t sequence;
+
+	/* Either -errno or 0 if @target was found.  */
+	int error;
+	Node *target;
+
+	/* Root of the file-system this link was resolved in.  */
+	const Node *root;
+
+	/* Symlink count when this link was resolved, and highest
+	 * symlink count reached from there.  */
+	size_t count;
+	size_t depth;
+
+	/* Generation and number of creations of the tree when this
+	 * link was resolved.  */
+	size_t generation;
+	size_t creations;
+} Resolution;
 
 extern const char *get_symlink(Node *node, int *error);
+extern int read_symlink(Tree *tree, Node *node, size_t generation);
+extern bool load_resolution(const Node *node, Resolution *resolution);
+extern void store_resolution(Node *node, const Resolution *resolution);
 
 #endif /* PROOT_VFS_SYMLINK */
@@ -22,27 +22,37 @@
 
 #include <stdio.h>	/* fprintf(3), */
 #include <errno.h>	/* EBUSY, */
+#include <assert.h>	/* assert(3), */
+#include <pthread.h>	/* pthread_*, */
+#include <stdlib.h>	/* free(3), */
+#include <unistd.h>	/* close(2), */
 #include <dirent.h>	/* DT_*, */
 #include <talloc.h>
-#include <uthash.h>
 #include "vfs/tree.h"
 #include "vfs/node.h"
+#include "vfs/cache.h"
+#include "vfs/visit.h"
+#include "vfs/stats.h"
+#include "vfs/clone.h"
+
+/* State of print_tree_(), see print_node().  */
+typedef struct {
+	FILE *file;
+	size_t indentation;
+} Printer;
 
 /**
- * Print in @file a human readable format of @root, then perform
- * recursively the same for @root node's children.
+ * Print in @printer->file a human readable format of @node, @depth
+ * levels below the root of the tree being printed.
  */
-void print_tree_(const Node *root, FILE *file, size_t indentation)
+static int print_node(Node *node, size_t depth, void *data)
 {
-	Node *child;
-	size_t i;
+	const Printer *printer = data;
+	FILE *file = printer->file;
 
-	for (i = 0; i < indentation; i++)
-		fprintf(file, " ");
+	fprintf(file, "%*s%s [type: ", (int) (printer->indentation + 2 * depth), "", node->name);
 
-	fprintf(file, "%s [type: ", root->name);
-
-	switch (root->type) {
+	switch (node->type) {
 	case DT_REG:	fprintf(file, "regular");	break;
 	case DT_DIR:	fprintf(file, "directory");	break;
 	case DT_LNK:	fprintf(file, "symlink");	break;
@@ -50,19 +60,55 @@ void print_tree_(const Node *root, FILE *file, size_t indentation)
 	case DT_CHR:	fprintf(file, "char. dev.");	break;
 	case DT_FIFO:	fprintf(file, "fifo");		break;
 	case DT_SOCK:	fprintf(file, "socket");	break;
-	default: fprintf(file, "unknown (%x)", root->type); break;
+	default: fprintf(file, "unknown (%x)", node->type); break;
 	}
 
-	fprintf(file, "; actual path: %s",	root->path_.actual);
-	fprintf(file, "; virtual path: %s",	root->path_.virtual);
-	fprintf(file, "; evaluator: %p",	root->evaluator);
-	fprintf(file, "; special: %d",		root->special);
+	fprintf(file, "; actual path: %s",	node->path_.actual);
+	fprintf(file, "; virtual path: %s",	node->path_.virtual);
+	fprintf(file, "; evaluator: %p",	node->evaluator);
+	fprintf(file, "; special: %d",		node->special);
+	fprintf(file, "; negative: %d",		node->negative);
 
 	fprintf(file, "]\n");
 
-	/* No child deletion, so no need for HASH_ITER.  */
-	for (child = root->children; child != NULL; child = child->hh.next)
-		print_tree_(child, file, indentation + 2);
+	return 0;
+}
+
+/**
+ * Print in @file a human readable format of @root, then perform the
+ * same for all @root node's descendants.
+ */
+void print_tree_(const Node *root, FILE *file, size_t indentation)
+{
+	Printer printer = { .file = file, .indentation = indentation };
+
+	/* Nodes are not modified.  */
+	(void) visit_tree((Node *) root, print_node, NULL, &printer);
+}
+
+/**
+ * Delete @node, unless it is the root of the deletion, see
+ * delete_tree().  @data points to the number of deleted nodes.  This
+ * function returns -EBUSY if @node is referenced elsewhere,
+ * otherwise 0.
+ */
+static int delete_child(Node *node, size_t depth, void *data)
+{
+	size_t *nb_deleted_nodes = data;
+	size_t reference_count;
+
+	if (depth == 0)
+		return 0;
+
+	reference_count = talloc_reference_count(node);
+	if (reference_count > 1)
+		return -EBUSY;
+
+	delete_node(node);
+
+	(*nb_deleted_nodes)++;
+
+	return 0;
 }
 
 /**
@@ -73,27 +119,11 @@ void print_tree_(const Node *root, FILE *file, size_t indentation)
 static ssize_t delete_children(Node *parent)
 {
 	size_t nb_deleted_nodes = 0;
-	ssize_t status;
-	Node *child;
-	Node *tmp;
-
-	HASH_ITER(hh, parent->children, child, tmp) {
-		size_t reference_count;
-
-		status = delete_children(child);
-		if (status < 0)
-			return status;
-		nb_deleted_nodes += status;
-
-		reference_count = talloc_reference_count(child);
-		if (reference_count > 1)
-			return -EBUSY;
+	int status;
 
-		HASH_DEL(parent->children, child);
-		TALLOC_FREE(child);
-
-		nb_deleted_nodes++;
-	}
+	status = visit_tree(parent, NULL, delete_child, &nb_deleted_nodes);
+	if (status < 0)
+		return status;
 
 	return nb_deleted_nodes;
 }
@@ -101,24 +131,193 @@ static ssize_t delete_children(Node *parent)
 /**
  * Delete recursively @root.  This function returns -EBUSY if @root
  * node or one of its children is referenced elsewhere, otherwise the
- * number of deleted nodes.  */
+ * number of deleted nodes.  No other thread may use this tree
+ * anymore once it is deleted.  */
 ssize_t delete_tree(Node *root)
 {
 	size_t nb_deleted_nodes = 0;
 	size_t reference_count;
 	ssize_t status;
 
+	write_lock_tree(root->tree);
+
+	bump_generation(root);
+
 	status = delete_children(root);
 	if (status < 0)
-		return status;
+		goto end;
 	nb_deleted_nodes += status;
 
 	reference_count = talloc_reference_count(root);
-	if (reference_count > 1)
-		return -EBUSY;
+	if (reference_count > 1) {
+		status = -EBUSY;
+		goto end;
+	}
+
+	status = 0;
+end:
+	write_unlock_tree(root->tree);
+	if (status < 0)
+		return status;
+
+	detach_clones(root->tree);
 
 	TALLOC_FREE(root);
 	nb_deleted_nodes++;
 
 	return nb_deleted_nodes;
 }
+
+/**
+ * Enable or disable the lazy lookup mode for @node's tree: when
+ * enabled, looking up a child of a directory that was not filled yet
+ * only checks this child, see lookup_child().
+ */
+void set_lazy_lookup(Node *node, bool enable)
+{
+	write_lock_tree(node->tree);
+	node->tree->lazy_lookup = enable;
+	write_unlock_tree(node->tree);
+}
+
+/**
+ * Release the resources of @tree that are not managed by talloc.
+ */
+static int tree_destructor(Tree *tree)
+{
+	(void) pthread_rwlock_destroy(&tree->lock);
+	(void) pthread_mutex_destroy(&tree->fills.lock);
+	(void) pthread_cond_destroy(&tree->fills.done);
+	(void) pthread_rwlock_destroy(&tree->watch.lock);
+	(void) pthread_mutex_destroy(&tree->descriptors.lock);
+	free(tree->fills.nodes);
+
+	release_origin(tree);
+
+	if (tree->watch.fd >= 0)
+		(void) close(tree->watch.fd);
+
+	return 0;
+}
+
+/**
+ * Initialize the locks of @tree, a newly zero-allocated tree.  This
+ * function returns -errno if an error occurred, otherwise 0.
+ */
+int init_tree(Tree *tree)
+{
+	pthread_rwlockattr_t attributes;
+	int status;
+
+	/* Epoch 0 is never reached, see revalidate_node().  */
+	tree->binding_epoch = 1;
+
+	status = pthread_rwlockattr_init(&attributes);
+	if (status != 0)
+		return -status;
+
+	/* Readers never nest, so writers can be preferred: fills
+	 * and flushes are not starved by a stream of lookups.  */
+	(void) pthread_rwlockattr_setkind_np(&attributes,
+				PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+
+	status = pthread_rwlock_init(&tree->lock, &attributes);
+	(void) pthread_rwlockattr_destroy(&attributes);
+	if (status != 0)
+		return -status;
+
+	status = pthread_mutex_init(&tree->fills.lock, NULL);
+	if (status != 0) {
+		(void) pthread_rwlock_destroy(&tree->lock);
+		return -status;
+	}
+
+	status = pthread_cond_init(&tree->fills.done, NULL);
+	if (status != 0) {
+		(void) pthread_rwlock_destroy(&tree->lock);
+		(void) pthread_mutex_destroy(&tree->fills.lock);
+		return -status;
+	}
+
+	status = pthread_rwlock_init(&tree->watch.lock, NULL);
+	if (status != 0) {
+		(void) pthread_rwlock_destroy(&tree->lock);
+		(void) pthread_mutex_destroy(&tree->fills.lock);
+		(void) pthread_cond_destroy(&tree->fills.done);
+		return -status;
+	}
+
+	status = pthread_mutex_init(&tree->descriptors.lock, NULL);
+	if (status != 0) {
+		(void) pthread_rwlock_destroy(&tree->lock);
+		(void) pthread_mutex_destroy(&tree->fills.lock);
+		(void) pthread_cond_destroy(&tree->fills.done);
+		(void) pthread_rwlock_destroy(&tree->watch.lock);
+		return -status;
+	}
+
+	tree->watch.fd = -1;
+
+	talloc_set_destructor(tree, tree_destructor);
+
+	status = init_tree_stats(tree);
+	if (status < 0)
+		return status;
+
+	return init_lookup_cache(tree);
+}
+
+/**
+ * Check whether @tree is write-locked by the current thread.
+ */
+bool is_write_locked(const Tree *tree)
+{
+	return __atomic_load_n(&tree->writer_depth, __ATOMIC_RELAXED) > 0
+		&& pthread_equal(__atomic_load_n(&tree->writer, __ATOMIC_RELAXED),
+				pthread_self());
+}
+
+/**
+ * Lock @tree for writing.  This lock is recursive: a thread that
+ * holds it can lock it again, for reading or for writing.  However,
+ * a thread that holds the read lock must not lock it for writing.
+ */
+void write_lock_tree(Tree *tree)
+{
+	if (!is_write_locked(tree)) {
+		(void) pthread_rwlock_wrlock(&tree->lock);
+		__atomic_store_n(&tree->writer, pthread_self(), __ATOMIC_RELAXED);
+	}
+
+	__atomic_add_fetch(&tree->writer_depth, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Unlock @tree, as locked by write_lock_tree().
+ */
+void write_unlock_tree(Tree *tree)
+{
+	assert(is_write_locked(tree));
+
+	if (__atomic_sub_fetch(&tree->writer_depth, 1, __ATOMIC_RELAXED) == 0)
+		(void) pthread_rwlock_unlock(&tree->lock);
+}
+
+/**
+ * Lock @tree for reading.  This does nothing if the current thread
+ * holds the write lock already.
+ */
+void read_lock_tree(Tree *tree)
+{
+	if (!is_write_locked(tree))
+		(void) pthread_rwlock_rdlock(&tree->lock);
+}
+
+/**
+ * Unlock @tree, as locked by read_lock_tree().
+ */
+void read_unlock_tree(Tree *tree)
+{
+	if (!is_write_locked(tree))
+		(void) pthread_rwlock_unlock(&tree->lock);
+}
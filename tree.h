@@ -23,10 +23,207 @@
 #ifndef PROOT_VFS_TREE
 #define PROOT_VFS_TREE
 
+#include <stddef.h>	/* size_t, */
+#include <stdint.h>	/* uint64_t, */
+#include <stdio.h>	/* FILE, */
+#include <pthread.h>	/* pthread_*, */
 #include "vfs/node.h"
 
+struct lookup_cache_slot;
+struct snapshot;
+struct watch;
+struct descriptor;
+struct stats;
+struct origin;
+struct evaluator;
+struct binding;
+
+/* Information shared by all the nodes of a tree, it is allocated
+ * with the root node.  */
+typedef struct tree
+{
+	/* Nodes are read with the read side of this lock, and
+	 * modified with its write side, see write_lock_tree().  */
+	pthread_rwlock_t lock;
+	pthread_t writer;
+	size_t writer_depth;
+
+	/* Directories being filled without holding the lock, so as
+	 * concurrent fills of the same directory are done once, see
+	 * start_fill().  */
+	struct {
+		pthread_mutex_t lock;
+		pthread_cond_t done;
+		const Node **nodes;
+		size_t nb_nodes;
+	} fills;
+
+	/* Incremented each time nodes are flushed or deleted, or an
+	 * actual path is changed: anything computed from this tree
+	 * is valid only for a given generation.  */
+	size_t generation;
+
+	/* Incremented each time a node is created by a lookup: this
+	 * invalidates only the negative results, see walk_path().  */
+	size_t creations;
+
+	/* Incremented each time a binding is installed, replaced or
+	 * removed, see set_actual_path().  Nodes below this binding
+	 * that were checked during a previous epoch are checked again
+	 * once walked, instead of flushing its whole subtree.  */
+	uint32_t binding_epoch;
+
+	/* Special nodes by actual path, so as actual paths are
+	 * translated back to virtual ones, see vfs/binding.c.  */
+	struct {
+		struct binding **buckets;
+		size_t nb_buckets;
+		size_t nb_bindings;
+	} bindings;
+
+	/* Whether missing children are looked up one by one instead
+	 * of filling the whole directory, see lookup_child().  */
+	bool lazy_lookup;
+
+	/* Attributes fetched for all the children of a directory as
+	 * soon as it is filled, see set_batch_attributes().  */
+	unsigned int batch_attributes;
+
+	/* Listings and symlink targets loaded from a snapshot file
+	 * instead of the actual file-system, see vfs/snapshot.c.  */
+	struct snapshot *snapshot;
+
+	/* Directories watched with inotify(7), by watch descriptor
+	 * and by node, see vfs/watch.c.  Events are drained with the
+	 * write side of @lock, and directories are read with its
+	 * read side.  */
+	struct {
+		int fd;
+		pthread_rwlock_t lock;
+		struct watch *by_wd;
+		struct watch *by_node;
+		uint64_t next_drain;
+	} watch;
+
+	/* O_PATH descriptors of recently used directories, so as
+	 * their children are opened relatively to them; they are
+	 * evicted with a clock, see vfs/descriptor.c.  */
+	struct {
+		pthread_mutex_t lock;
+		struct descriptor *slots;
+		size_t nb_slots;
+		size_t max;
+		size_t hand;
+	} descriptors;
+
+	/* Full-path lookup cache, see vfs/cache.c.  */
+	struct {
+		struct lookup_cache_slot *slots;
+		size_t hits;
+		size_t misses;
+	} lookup_cache;
+
+	/* Estimated memory used by the nodes and the strings they
+	 * cache, and the budget above which children of the least
+	 * recently used directories are evicted, see vfs/memory.c.  */
+	struct {
+		size_t budget;
+		size_t usage;
+		Node **clock;
+		size_t nb_directories;
+		size_t max_directories;
+		size_t hand;
+	} memory;
+
+	/* Evaluators attached to the nodes whose virtual path matches
+	 * their pattern, and how many times nodes were evaluated or
+	 * their evaluation was reused, see vfs/evaluator.c.  */
+	struct {
+		struct evaluator **slots;
+		size_t nb_slots;
+		size_t calls;
+		size_t hits;
+	} evaluators;
+
+	/* Link to the tree this one was cloned from, if any, and the
+	 * link given to the clones of this one, see vfs/clone.c.  The
+	 * binding epoch and the number of creations of the former tree
+	 * when this one was cloned tell whether it changed since.  */
+	struct {
+		struct origin *from;
+		struct origin *link;
+		uint32_t binding_epoch;
+		size_t creations;
+	} origin;
+
+#ifdef VFS_STATS
+	/* Counters and latency histograms, see vfs/stats.h.  */
+	struct stats *stats;
+#endif
+} Tree;
+
 extern void print_tree_(const Node *root, FILE *file, size_t zero);
 extern ssize_t delete_tree(Node *root);
+extern void set_lazy_lookup(Node *node, bool enable);
+extern int init_tree(Tree *tree);
+extern bool is_write_locked(const Tree *tree);
+extern void write_lock_tree(Tree *tree);
+extern void write_unlock_tree(Tree *tree);
+extern void read_lock_tree(Tree *tree);
+extern void read_unlock_tree(Tree *tree);
+
+/**
+ * Invalidate everything that was computed from @node's tree, as
+ * lookup results.  The tree has to be write-locked.
+ */
+static inline void bump_generation(const Node *node)
+{
+	__atomic_add_fetch(&node->tree->generation, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get the current generation of @tree, see bump_generation().
+ */
+static inline size_t get_generation(const Tree *tree)
+{
+	return __atomic_load_n(&tree->generation, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Check whether a binding @node's actual path depends on was changed
+ * since this path was checked, see revalidate_node().  That is, if
+ * @node or one of its ancestors up to the nearest bound one was bound
+ * or unbound during a later epoch.  Otherwise @node is recorded as
+ * checked in the current epoch, so as it isn't walked up again.  The
+ * tree doesn't have to be locked: ancestors of @node can't be deleted
+ * before @node, and binding changes happen-before the new epoch.
+ */
+static inline bool is_binding_stale(const Node *node)
+{
+	uint32_t epoch = __atomic_load_n(&node->tree->binding_epoch, __ATOMIC_ACQUIRE);
+	uint32_t checked = __atomic_load_n(&node->binding_epoch, __ATOMIC_RELAXED);
+	const Node *ancestor;
+
+	if (checked == epoch)
+		return false;
+
+	if (checked == 0)
+		return true;
+
+	for (ancestor = node; ; ancestor = ancestor->parent) {
+		if (__atomic_load_n(&ancestor->bound_epoch, __ATOMIC_RELAXED) > checked)
+			return true;
+
+		if (ancestor->special || ancestor->parent == ancestor)
+			break;
+	}
+
+	/* Fails if @node was marked as moved in the meantime.  */
+	(void) __atomic_compare_exchange_n((uint32_t *) &node->binding_epoch, &checked, epoch,
+					false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+	return false;
+}
 
 static inline void print_tree(const Node *root, FILE *file)
 {
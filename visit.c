@@ -0,0 +1,103 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+
+#include <stdint.h>	/* uint32_t, */
+#include "vfs/visit.h"
+#include "vfs/node.h"
+
+/**
+ * Hint the CPU that the child of @parent at @position, if any, is
+ * visited soon.
+ */
+static inline void prefetch_child(const Node *parent, uint32_t position)
+{
+	if (position < parent->children.nb_nodes)
+		__builtin_prefetch(parent->children.nodes[position]);
+}
+
+/**
+ * Walk @root and its descendants, without recursion: the stack of
+ * the walk is the tree itself, that is, the parent of each node and
+ * its position among its siblings.  Each node is passed to @pre
+ * before its children, and to @post after them, with @data.  The
+ * descendants of a node are skipped if @pre returns VISIT_PRUNE, it
+ * is still passed to @post though.
+ *
+ * @pre may add children to the visited node, and @post may delete
+ * the visited node -- except @root -- but no other node may be added
+ * or deleted meanwhile.  This function returns the first error
+ * returned by a visitor, if any, otherwise 0.
+ */
+int visit_tree(Node *root, Visitor pre, Visitor post, void *data)
+{
+	Node *node = root;
+	size_t depth = 0;
+	int status;
+
+	while (1) {
+		status = (pre != NULL ? pre(node, depth, data) : 0);
+		if (status < 0)
+			return status;
+
+		if (status != VISIT_PRUNE && node->children.nb_nodes > 0) {
+			prefetch_child(node, 1);
+			node = node->children.nodes[0];
+			depth++;
+			continue;
+		}
+
+		/* Go up until a node has a sibling left to visit.  */
+		while (1) {
+			uint32_t nb_siblings;
+			uint32_t position;
+			Node *parent;
+
+			if (node == root)
+				return (post != NULL ? post(node, depth, data) : 0);
+
+			parent      = node->parent;
+			position    = node->position;
+			nb_siblings = parent->children.nb_nodes;
+
+			if (post != NULL) {
+				status = post(node, depth, data);
+				if (status < 0)
+					return status;
+			}
+
+			/* The last sibling takes the position of a deleted
+			 * node, see remove_from_index().  */
+			if (parent->children.nb_nodes == nb_siblings)
+				position++;
+
+			if (position < parent->children.nb_nodes) {
+				prefetch_child(parent, position + 1);
+				node = parent->children.nodes[position];
+				break;
+			}
+
+			node = parent;
+			depth--;
+		}
+	}
+}
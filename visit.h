@@ -0,0 +1,40 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_VISIT
+#define PROOT_VFS_VISIT
+
+#include <stddef.h>	/* size_t, */
+#include "vfs/node.h"
+
+/* Returned by a pre-order visitor to skip the descendants of the
+ * visited node, see visit_tree().  */
+#define VISIT_PRUNE 1
+
+/* Called on @node, @depth levels below the root of the walk.  A
+ * visitor returns -errno to stop the walk, otherwise 0 or
+ * VISIT_PRUNE.  */
+typedef int (*Visitor)(Node *node, size_t depth, void *data);
+
+extern int visit_tree(Node *root, Visitor pre, Visitor post, void *data);
+
+#endif /* PROOT_VFS_VISIT */
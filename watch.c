@@ -0,0 +1,485 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#include <sys/inotify.h>	/* inotify_*(2), IN_*, */
+#include <sys/stat.h>	/* fstatat(2), struct stat, */
+#include <limits.h>	/* PATH_MAX, NAME_MAX, */
+#include <unistd.h>	/* read(2), close(2), */
+#include <fcntl.h>	/* AT_*, */
+#include <dirent.h>	/* DT_*, IFTODT, */
+#include <string.h>	/* str*(3), mem*(3), */
+#include <pthread.h>	/* pthread_*, */
+#include <assert.h>	/* assert(3), */
+#include <errno.h>	/* E*, errno(3), */
+#include <stdint.h>	/* uint64_t, */
+#include <time.h>	/* clock_gettime(3), */
+#include <talloc.h>
+#include <uthash.h>
+#include "vfs/watch.h"
+#include "vfs/node.h"
+#include "vfs/path.h"
+#include "vfs/children.h"
+#include "vfs/memory.h"
+#include "vfs/tree.h"
+
+/* Events that change the entries of a directory.  */
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+/* Minimal interval between two drains from the lookup path, in
+ * nanoseconds: events are drained in batches, and a lookup doesn't
+ * pay for a read(2) when the previous one was that recent.  */
+#define WATCH_DRAIN_INTERVAL (1000 * 1000)
+
+/* Association of an inotify watch descriptor with a directory.  The
+ * same directory might be reachable through several nodes, hence
+ * the @next list.  */
+typedef struct watch
+{
+	int wd;
+	Node *node;
+	struct watch *next;
+
+	/* Only the first watch of a list is in this hash table.  */
+	UT_hash_handle by_wd;
+
+	UT_hash_handle by_node;
+} Watch;
+
+/**
+ * Lock @tree so as no events are drained until end_watch() is
+ * called.  This ensures events for a directory being filled are
+ * drained only once the node of this latter is registered, see
+ * finish_fill().  The tree must not be locked by the current thread.
+ * This function returns false if directories of @tree are not
+ * watched.
+ */
+bool begin_watch(Tree *tree)
+{
+	if (!is_watching(tree))
+		return false;
+
+	(void) pthread_rwlock_rdlock(&tree->watch.lock);
+
+	if (!is_watching(tree)) {
+		(void) pthread_rwlock_unlock(&tree->watch.lock);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Unlock @tree, as locked by begin_watch().
+ */
+void end_watch(Tree *tree)
+{
+	(void) pthread_rwlock_unlock(&tree->watch.lock);
+}
+
+/**
+ * Start watching the directory at @path.  Its node has to be
+ * registered with register_watch() then, or the watch released with
+ * release_watch().  This function returns -errno if an error
+ * occurred, otherwise the watch descriptor.
+ */
+int add_watch(Tree *tree, const char *path)
+{
+	int wd;
+
+	wd = inotify_add_watch(tree->watch.fd, path, WATCH_MASK);
+	if (wd < 0)
+		return -errno;
+
+	return wd;
+}
+
+/**
+ * Associate @node to the watch descriptor @wd, as returned by
+ * add_watch().  This does nothing if @wd is not valid.  The tree has
+ * to be write-locked.
+ */
+void register_watch(Node *node, int wd)
+{
+	Tree *tree = node->tree;
+	Watch *watch;
+	Watch *head;
+
+	assert(is_write_locked(tree));
+
+	if (wd < 0)
+		return;
+
+	HASH_FIND(by_node, tree->watch.by_node, &node, sizeof(Node *), watch);
+	if (watch != NULL) {
+		if (watch->wd == wd)
+			return;
+		unregister_watch(node);
+	}
+
+	watch = talloc_zero(tree, Watch);
+	if (watch == NULL) {
+		release_watch(tree, wd);
+		return;
+	}
+
+	watch->wd   = wd;
+	watch->node = node;
+
+	HASH_FIND(by_wd, tree->watch.by_wd, &wd, sizeof(int), head);
+	if (head != NULL) {
+		watch->next = head->next;
+		head->next = watch;
+	}
+	else
+		HASH_ADD_KEYPTR(by_wd, tree->watch.by_wd, &watch->wd, sizeof(int), watch);
+
+	HASH_ADD_KEYPTR(by_node, tree->watch.by_node, &watch->node, sizeof(Node *), watch);
+}
+
+/**
+ * Stop watching @wd if no node is associated to it.  The tree has to
+ * be write-locked.
+ */
+void release_watch(Tree *tree, int wd)
+{
+	Watch *head;
+
+	assert(is_write_locked(tree));
+
+	if (wd < 0)
+		return;
+
+	HASH_FIND(by_wd, tree->watch.by_wd, &wd, sizeof(int), head);
+	if (head == NULL)
+		(void) inotify_rm_watch(tree->watch.fd, wd);
+}
+
+/**
+ * Remove @watch from the watches of its tree, without releasing its
+ * watch descriptor.
+ */
+static void delete_watch(Tree *tree, Watch *watch)
+{
+	Watch *head;
+
+	HASH_FIND(by_wd, tree->watch.by_wd, &watch->wd, sizeof(int), head);
+	if (head == watch) {
+		HASH_DELETE(by_wd, tree->watch.by_wd, watch);
+		if (watch->next != NULL)
+			HASH_ADD_KEYPTR(by_wd, tree->watch.by_wd, &watch->next->wd,
+					sizeof(int), watch->next);
+	}
+	else if (head != NULL) {
+		while (head->next != watch)
+			head = head->next;
+		head->next = watch->next;
+	}
+
+	HASH_DELETE(by_node, tree->watch.by_node, watch);
+	talloc_free(watch);
+}
+
+/**
+ * Stop watching @node, typically before it is freed.  The tree has to
+ * be write-locked.
+ */
+void unregister_watch(Node *node)
+{
+	Tree *tree = node->tree;
+	Watch *watch;
+	int wd;
+
+	if (tree->watch.by_node == NULL)
+		return;
+
+	HASH_FIND(by_node, tree->watch.by_node, &node, sizeof(Node *), watch);
+	if (watch == NULL)
+		return;
+
+	wd = watch->wd;
+	delete_watch(tree, watch);
+	release_watch(tree, wd);
+}
+
+/**
+ * Start watching @node, a directory.  This is done before its
+ * entries are read, so as no changes are missed.  The tree has to be
+ * write-locked.
+ */
+void watch_directory(Node *node)
+{
+	char path[PATH_MAX];
+	Watch *watch;
+
+	assert(is_write_locked(node->tree));
+
+	if (!is_watching(node->tree))
+		return;
+
+	HASH_FIND(by_node, node->tree->watch.by_node, &node, sizeof(Node *), watch);
+	if (watch != NULL)
+		return;
+
+	if (render_path(node, ACTUAL_PATH, path, sizeof(path)) < 0)
+		return;
+
+	register_watch(node, add_watch(node->tree, path));
+}
+
+/**
+ * Watch recursively @node and its descendants that have children.
+ */
+static void watch_subtree(Node *node)
+{
+	Node *child;
+
+	if (node->type != DT_DIR || node->negative)
+		return;
+
+	if (node->children_filled || node->children.nb_nodes != 0)
+		watch_directory(node);
+
+	FOR_EACH_CHILD(child, node)
+		watch_subtree(child);
+}
+
+/**
+ * Update @node->children according to the current state of its entry
+ * @name: this entry is added, removed, or retyped, then its cached
+ * path and symlink are cleared.  The tree has to be write-locked.
+ */
+static void refresh_child(Node *node, const char *name)
+{
+	char path[PATH_MAX];
+	struct stat statl;
+	bool exists;
+	ssize_t size;
+	Node *child;
+	int type;
+
+	size = render_path(node, ACTUAL_PATH, path, sizeof(path));
+	if (size < 0 || size + 1 + strlen(name) >= sizeof(path))
+		return;
+
+	if (size > 0 && path[size - 1] != '/')
+		path[size++] = '/';
+	strcpy(path + size, name);
+
+	exists = (fstatat(AT_FDCWD, path, &statl, AT_SYMLINK_NOFOLLOW) == 0);
+	type = exists ? IFTODT(statl.st_mode) : DT_UNKNOWN;
+
+	child = find_in_index(node, name, -1);
+
+	if (child == NULL) {
+		if (exists && node->children_filled) {
+			child = add_new_child(node, name, -1, type);
+			if (child != NULL)
+				child->ino = statl.st_ino;
+		}
+		return;
+	}
+
+	/* Special children are not from the actual directory.  */
+	if (child->special)
+		return;
+
+	(void) flush_children(child, false);
+	flush_path(child, ACTUAL_PATH);
+	flush_path(child, VIRTUAL_PATH);
+
+	account_memory(child->tree, -string_footprint(child->symlink_));
+	TALLOC_FREE(child->symlink_);
+
+	if (!exists) {
+		if (child->children.nb_nodes == 0 && talloc_reference_count(child) <= 1)
+			delete_node(child);
+		else
+			child->negative = true;
+		return;
+	}
+
+	child->negative = false;
+	child->type = type;
+	child->ino = statl.st_ino;
+}
+
+/**
+ * Apply @event to the nodes of @tree, and set *@changed to one of
+ * the nodes that were updated, if any.  This function returns false
+ * if events were lost.  The tree has to be write-locked.
+ */
+static bool apply_event(Tree *tree, const struct inotify_event *event, Node **changed)
+{
+	Watch *watch;
+	Watch *next;
+
+	if ((event->mask & IN_Q_OVERFLOW) != 0)
+		return false;
+
+	HASH_FIND(by_wd, tree->watch.by_wd, &event->wd, sizeof(int), watch);
+
+	/* The directory was removed, or it is not watched anymore.  */
+	if ((event->mask & IN_IGNORED) != 0) {
+		for (; watch != NULL; watch = next) {
+			next = watch->next;
+			delete_watch(tree, watch);
+		}
+		return true;
+	}
+
+	if (event->len == 0)
+		return true;
+
+	for (; watch != NULL; watch = watch->next) {
+		refresh_child(watch->node, event->name);
+		*changed = watch->node;
+	}
+
+	return true;
+}
+
+/**
+ * Flush the whole tree that @node belongs to, when events were lost.
+ */
+static void flush_all(Node *node)
+{
+	while (node->parent != node)
+		node = node->parent;
+
+	(void) flush_children(node, false);
+}
+
+/**
+ * Read and apply pending inotify events of @tree, unless the previous
+ * drain was done less than WATCH_DRAIN_INTERVAL ago and @force is
+ * false, or another thread is draining already.  This does nothing
+ * if the tree is write-locked by the current thread; it must not be
+ * read-locked either.
+ */
+void drain_watch_events(Tree *tree, bool force)
+{
+	char buffer[16 * 1024] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct timespec timespec;
+	uint64_t now;
+
+	/* Nodes the caller is using must not be flushed.  */
+	if (!is_watching(tree) || is_write_locked(tree))
+		return;
+
+	if (!force) {
+		(void) clock_gettime(CLOCK_MONOTONIC_COARSE, &timespec);
+		now = timespec.tv_sec * 1000000000ULL + timespec.tv_nsec;
+
+		if (now < __atomic_load_n(&tree->watch.next_drain, __ATOMIC_RELAXED))
+			return;
+		__atomic_store_n(&tree->watch.next_drain, now + WATCH_DRAIN_INTERVAL,
+				__ATOMIC_RELAXED);
+
+		if (pthread_rwlock_trywrlock(&tree->watch.lock) != 0)
+			return;
+	}
+	else
+		(void) pthread_rwlock_wrlock(&tree->watch.lock);
+
+	while (is_watching(tree)) {
+		Node *changed = NULL;
+		bool lost = false;
+		ssize_t size;
+		char *cursor;
+
+		size = read(tree->watch.fd, buffer, sizeof(buffer));
+		if (size <= 0)
+			break;
+
+		write_lock_tree(tree);
+
+		for (cursor = buffer; cursor < buffer + size; ) {
+			const struct inotify_event *event = (struct inotify_event *) cursor;
+
+			if (!apply_event(tree, event, &changed))
+				lost = true;
+
+			cursor += sizeof(struct inotify_event) + event->len;
+		}
+
+		if (lost && tree->watch.by_node != NULL)
+			flush_all(tree->watch.by_node->node);
+		else if (changed != NULL)
+			bump_generation(changed);
+
+		write_unlock_tree(tree);
+	}
+
+	(void) pthread_rwlock_unlock(&tree->watch.lock);
+}
+
+/**
+ * Enable or disable the watcher mode for @node's tree.  When enabled,
+ * directories that are filled, or that are already, are watched with
+ * inotify(7).  Changes of their entries are then applied to the
+ * corresponding children only, instead of flushing whole subtrees;
+ * they are drained in batches from find_node(), see
+ * drain_watch_events().  The tree must not be locked by the current
+ * thread.  This function returns -errno if an error occurred,
+ * otherwise 0.
+ */
+int set_watch_mode(Node *node, bool enable)
+{
+	Tree *tree = node->tree;
+	Node *root = node;
+	Watch *watch;
+	Watch *tmp;
+	int status = 0;
+	int fd;
+
+	(void) pthread_rwlock_wrlock(&tree->watch.lock);
+	write_lock_tree(tree);
+
+	if (enable && !is_watching(tree)) {
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd < 0)
+			status = -errno;
+		else {
+			__atomic_store_n(&tree->watch.fd, fd, __ATOMIC_RELAXED);
+
+			while (root->parent != root)
+				root = root->parent;
+			watch_subtree(root);
+		}
+	}
+	else if (!enable && is_watching(tree)) {
+		HASH_ITER(by_node, tree->watch.by_node, watch, tmp) {
+			HASH_DELETE(by_node, tree->watch.by_node, watch);
+			talloc_free(watch);
+		}
+		tree->watch.by_wd = NULL;
+
+		fd = tree->watch.fd;
+		__atomic_store_n(&tree->watch.fd, -1, __ATOMIC_RELAXED);
+		(void) close(fd);
+	}
+
+	write_unlock_tree(tree);
+	(void) pthread_rwlock_unlock(&tree->watch.lock);
+
+	return status;
+}
@@ -0,0 +1,49 @@
+/* -*- c-set-style: "K&R"; c-basic-offset: 8 -*-
+ *
+ * This file is part of PRoot.
+ *
+ * Copyright (C) 2014 STMicroelectronics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+#ifndef PROOT_VFS_WATCH
+#define PROOT_VFS_WATCH
+
+#include <stdbool.h>	/* bool, */
+#include "vfs/node.h"
+#include "vfs/tree.h"
+
+extern int set_watch_mode(Node *node, bool enable);
+extern void drain_watch_events(Tree *tree, bool force);
+extern bool begin_watch(Tree *tree);
+extern void end_watch(Tree *tree);
+extern int add_watch(Tree *tree, const char *path);
+extern void register_watch(Node *node, int wd);
+extern void release_watch(Tree *tree, int wd);
+extern void unregister_watch(Node *node);
+extern void watch_directory(Node *node);
+
+/**
+ * Check whether directories of @tree are watched, see
+ * set_watch_mode().
+ */
+static inline bool is_watching(const Tree *tree)
+{
+	return __atomic_load_n(&tree->watch.fd, __ATOMIC_RELAXED) >= 0;
+}
+
+#endif /* PROOT_VFS_WATCH */